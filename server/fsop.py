@@ -1,5 +1,11 @@
 import json
+import math
+import os
 import re
+import shutil
+import threading
+from bisect import bisect_left, insort
+from functools import lru_cache
 from pathlib import Path
 
 MODULE_DESCRIPTION_R = "Module name argument. Can be the name of any module that you have read-access to. Can also be one of the following special keywords: `.children` denotes all children of the current module; `.` denotes the current module; `*` denotes all modules that you have read-access to."
@@ -10,6 +16,8 @@ PATH_DESCRIPTION_R = "Name of the file. This argument supports the `*` wildcard,
 
 PATH_DESCRIPTION_W = "Name of the file. Wildcards not supported. Must **not** contain `/`."
 
+PAGE_SIZE = 50 # lines read_lines returns when given a start but no count
+
 PURE_ASCII_WARNING = "**Content must be valid 8-bit ASCII.** Use a backslash to escape double quotes or other backslashes."
 
 NO_OP_COMMAND = {
@@ -69,6 +77,14 @@ READ_LINES_COMMAND = {
             "path": {
                 "type": "string",
                 "description": PATH_DESCRIPTION_R
+            },
+            "start_line": {
+                "type": "integer",
+                "description": f"First line to read. If given without `count`, a page of {PAGE_SIZE} lines is read. Leave out both `start_line` and `count` to read the whole file."
+            },
+            "count": {
+                "type": "integer",
+                "description": "Number of lines to read, starting at `start_line` (or at the first line if `start_line` is not given)."
             }
         },
         "required": ["module", "path"]
@@ -163,6 +179,37 @@ QUERY_MODULES_COMMAND = {
     }
 }
 
+SEARCH_COMMAND = {
+    "name": "search",
+    "description": "Search file contents for words and return the best matching lines, each with a few lines of context. Prefer this over reading whole files when looking for something specific.",
+    "parameters": {
+        "type": "object",
+        "properties": {
+            "query": {
+                "type": "string",
+                "description": "Words to search for. Matching ignores case and punctuation; lines containing more of the words, and rarer words, rank higher."
+            },
+            "module": {
+                "type": "string",
+                "description": MODULE_DESCRIPTION_R + " Defaults to `*`."
+            },
+            "path": {
+                "type": "string",
+                "description": PATH_DESCRIPTION_R + " Defaults to `*`."
+            },
+            "limit": {
+                "type": "integer",
+                "description": "Maximum number of matching lines to return (default 20, at most 100)."
+            },
+            "context": {
+                "type": "integer",
+                "description": "Number of lines to show before and after each match (default 1, at most 5)."
+            }
+        },
+        "required": ["query"]
+    }
+}
+
 CREATE_MODULE_COMMAND = {
     "name": "create_module",
     "description": "Create a new module",
@@ -202,11 +249,88 @@ DEFAULT_COMMANDS = {
     "append": APPEND_COMMAND,
     "edit": EDIT_COMMAND,
     "query_modules": QUERY_MODULES_COMMAND,
+    "search": SEARCH_COMMAND,
     "create_module": CREATE_MODULE_COMMAND,
     "answer": ANSWER_COMMAND
 } # `answer` is not considered a command; it is used for branching which is not a callable action
 
-PAGE_SIZE = 50
+@lru_cache(maxsize=256)
+def _compile_glob(pattern): # `*` matches any run of characters; everything else is literal
+    parts = pattern.split("*")
+    extension = parts[-1].rpartition(".")[2] if len(parts) > 1 and "." in parts[-1] else None
+    return parts, extension, re.compile(".*".join(re.escape(p) for p in parts), re.DOTALL)
+
+class FileIndex: # one module's files; positions are indices into the graph's list
+
+    def __init__(self, names):
+        self.names = names # the graph's own list
+        self.positions = {}
+        self.sorted = []
+        self.by_extension = {}
+        for name in list(names): self.add(name, len(self.sorted))
+
+    def add(self, name, pos):
+        self.positions.setdefault(name, pos)
+        insort(self.sorted, (name, pos))
+        self.by_extension.setdefault(name.rpartition(".")[2] if "." in name else "", []).append(pos)
+
+    def glob(self, pattern):
+        parts, extension, regex = _compile_glob(pattern)
+        if len(parts) == 1:
+            hits = [self.positions[pattern]] if pattern in self.positions else []
+        elif parts[0]:
+            hits = []
+            for i in range(bisect_left(self.sorted, (parts[0], -1)), len(self.sorted)):
+                name, pos = self.sorted[i]
+                if not name.startswith(parts[0]): break
+                if regex.fullmatch(name): hits.append(pos)
+            hits.sort()
+        elif extension is not None:
+            hits = [pos for pos in self.by_extension.get(extension, ()) if regex.fullmatch(self.names[pos])]
+        else:
+            hits = [pos for pos, name in enumerate(self.names) if regex.fullmatch(name)]
+        return [self.names[pos] for pos in hits]
+
+class DependencyGraph(dict): # the server's copy of a project's graph; mutations are recorded so only they are sent back to the client
+
+    # the lists keep their order for listing; membership checks go through the sets, which add_file/add_module keep in step
+    def __init__(self, graph):
+        super().__init__(graph)
+        self.delta = []
+        self.module_set = set(self["modules"])
+        self.child_sets = { m: set(c) for m, c in self["children"].items() }
+        self.file_sets = { m: set(f) for m, f in self["files"].items() }
+        self.file_indices = {} # built on a module's first wildcard match
+
+    def has_module(self, module):
+        return module in self.module_set
+
+    def is_child(self, parent, child):
+        return child in self.child_sets.get(parent, ())
+
+    def has_file(self, module, name):
+        return name in self.file_sets.get(module, ())
+
+    def glob(self, module, pattern): # the module's files matching `pattern`, in list order
+        if module not in self.file_indices: self.file_indices[module] = FileIndex(self["files"].get(module, []))
+        return self.file_indices[module].glob(pattern)
+
+    def add_file(self, module, name):
+        self["files"][module].append(name)
+        self.file_sets.setdefault(module, set()).add(name)
+        if module in self.file_indices: self.file_indices[module].add(name, len(self["files"][module]) - 1)
+        self.delta.append({ "op": "add_file", "module": module, "file": name })
+
+    def add_module(self, parent, name):
+        self["modules"].append(name)
+        self["children"][name] = []
+        self["files"][name] = []
+        self["children"][parent].append(name)
+        self.module_set.add(name)
+        self.child_sets[name] = set()
+        self.file_sets[name] = set()
+        self.child_sets.setdefault(parent, set()).add(name)
+        self.delta.append({ "op": "add_module", "module": name, "parent": parent })
 
 def _get_arg(res, arg, default=""):
     return res[arg] if arg in res.keys() else default
@@ -215,14 +339,14 @@ def _can_read(module, target, dgraph):
     return True # module == target or target == "global" or target in dgraph["children"][module] or target in dgraph["dependencies"][module]
 
 def _can_write(module, target, dgraph):
-    return module == target or target == "global" or target in dgraph["children"][module]
+    return module == target or target == "global" or dgraph.is_child(module, target)
 
 def _validate_fsop(module, target, dgraph, accessty):
     '''if target == ".dependencies":
         if accessty != "r": raise RuntimeError(f"Dependency modules are read-only.")
         return'''
     if target in [".children", "*", "."]: return
-    if target not in dgraph["modules"]: raise RuntimeError(f"Invalid module pattern `{target}`.")
+    if not dgraph.has_module(target): raise RuntimeError(f"Invalid module pattern `{target}`.")
     if not _can_read(module, target, dgraph) if accessty == "r" else _can_write(module, target, dgraph): 
         raise RuntimeError(f"Module `{module}` does not have permission to {'view the contents of' if accessty == 'r' else 'write to'} module `{target}`.")
 
@@ -234,14 +358,6 @@ def _get_modules(module, target, dgraph, accessty):
     if target == "*": return dgraph["modules"] # [module, "global"] + dgraph["children"][module] + (dgraph["dependencies"][module] if accessty == "r" else [])
     return [target]
 
-def _format_re(arg):
-    return arg.replace(".", "\\.").replace("*", ".*")
-
-def _populate_paths(target, pattern, args, candidates):
-    for c in candidates:
-        if re.fullmatch(pattern, c) is not None:
-            args.append([target, c])
-
 def _get_full_path(proot, target, path):
     if target == "global":
         return proot + path
@@ -250,25 +366,143 @@ def _get_full_path(proot, target, path):
 def _read_file(proot, target, path):
     with open(_get_full_path(proot, target, path), "r") as f: return f.read()
 
+def unshare(proot, path, keep_content=True):
+    # files of projects with a content store (.hll/manifest.json, see src/store.cpp) may be hard links shared with other
+    # files and projects; this gives the file its own inode before it is changed in place
+    try: st = os.stat(path)
+    except OSError: return
+    if st.st_nlink < 2 or not os.path.exists(proot + ".hll/manifest.json"): return
+    if not keep_content:
+        os.unlink(path)
+        return
+    tmp = f"{path}.hll-tmp-{os.getpid()}-{threading.get_ident()}"
+    shutil.copyfile(path, tmp)
+    os.chmod(tmp, st.st_mode & 0o7777 | 0o200) # blobs are read-only
+    os.utime(tmp, ns = (st.st_atime_ns, st.st_mtime_ns)) # the same content, so snapshots (src/snapshot.cpp) needn't read it again
+    os.replace(tmp, path)
+
+def unshare_writable(proot, module, dgraph):
+    # plugins write project files however they like, so before one runs every file its module may write (see _can_write)
+    # gets its own inode; whatever it does then can't reach a blob shared with other files, projects or snapshots
+    if not os.path.exists(proot + ".hll/manifest.json"): return
+    for target in dict.fromkeys([module, "global"] + dgraph["children"].get(module, [])):
+        for name in dgraph["files"].get(target, []): unshare(proot, _get_full_path(proot, target, name))
+
 def _write_file(proot, target, path, content, accessty):
     path = _get_full_path(proot, target, path)
+    LINE_INDICES.pop(path, None)
+    unshare(proot, path, accessty != "w")
     Path(path).parent.mkdir(parents = True, exist_ok = True)
     with open(path, accessty) as f: f.write(content)
-
-
-def _read_file_lines(proot, target, path):
-    with open(_get_full_path(proot, target, path), "r") as f:
-        return f.readlines()
-
-def _write_file_lines(proot, target, path, content, lines, sline, eline): #inclusive on both ends
-    path = _get_full_path(proot, target, path)
-    Path(path).parent.mkdir(parents = True, exist_ok = True)
-    with open(path, "w") as f:
-        newcontent = ""
-        for (i, page) in enumerate(lines):
-            if i < sline or i > eline: newcontent += page
-            elif i == sline: newcontent += content + "\n" # only append content once
-        f.write(newcontent) # erase old content and replace it with updated lines
+    _search_update(path)
+
+# line offsets per file path, rescanned only when the file's inode, size or mtime changes; lines keep their newline
+LINE_INDICES = {} # path -> ((inode, size, mtime), offsets: start of every line, then the file size)
+MAX_LINE_INDICES = 64
+
+def _stat_key(st):
+    return (st.st_ino, st.st_size, st.st_mtime_ns)
+
+def _line_index(path):
+    with open(path, "rb") as f:
+        key = _stat_key(os.fstat(f.fileno()))
+        cached = LINE_INDICES.get(path)
+        if cached is not None and cached[0] == key: return cached[1]
+        data = f.read()
+    offsets = [0] + [m.end() for m in re.finditer(b"\n", data)]
+    if offsets[-1] != len(data): offsets.append(len(data))
+    if path not in LINE_INDICES and len(LINE_INDICES) >= MAX_LINE_INDICES: LINE_INDICES.clear()
+    LINE_INDICES[path] = (key, offsets)
+    return offsets
+
+def _read_line_range(path, offsets, first, last): # lines [first, last)
+    with open(path, "rb") as f:
+        f.seek(offsets[first])
+        data = f.read(offsets[last] - offsets[first])
+    base = offsets[first]
+    return [data[offsets[i] - base:offsets[i + 1] - base].decode() for i in range(first, last)]
+
+def _splice_lines(path, offsets, sline, eline, content): # replaces lines [sline, eline] in place; the head of the file is never rewritten
+    replacement = content.encode()
+    start, end = offsets[sline], offsets[eline + 1]
+    with open(path, "r+b") as f:
+        if len(replacement) == end - start:
+            f.seek(start)
+            f.write(replacement)
+        else:
+            f.seek(end)
+            tail = f.read()
+            f.seek(start)
+            f.write(replacement)
+            f.write(tail)
+            f.truncate()
+        f.flush()
+        key = _stat_key(os.fstat(f.fileno()))
+    delta = len(replacement) - (end - start)
+    new_offsets = offsets[:sline + 1] + [start + m.end() for m in re.finditer(b"\n", replacement[:-1])] + [o + delta for o in offsets[eline + 1:]]
+    LINE_INDICES[path] = (key, new_offsets)
+    _search_update(path)
+
+# inverted index behind `search`; ranks exactly like search.cpp, which documents it. files are (re)indexed when a search
+# covers them and they changed, and right away when a built-in action writes them
+SEARCH_FILES = {} # path -> ((inode, size, mtime), { word: lines containing it, ascending })
+SEARCH_POSTINGS = {} # word -> paths of the files containing it
+SEARCH_LOCK = threading.Lock() # read-only actions, search included, run concurrently
+SEARCH_LIMIT, MAX_SEARCH_LIMIT = 20, 100
+SEARCH_CONTEXT, MAX_SEARCH_CONTEXT = 1, 5
+WORD_RE = re.compile(rb"[A-Za-z0-9_\x80-\xff]{2,}")
+
+def _search_words(query): # distinct, in order of first occurrence
+    return list(dict.fromkeys(w.lower() for w in WORD_RE.findall(query.encode())))
+
+def _search_unindex(path):
+    entry = SEARCH_FILES.pop(path, None)
+    if entry is None: return
+    for word in entry[1]:
+        holders = SEARCH_POSTINGS.get(word)
+        if holders is None: continue
+        holders.discard(path)
+        if not holders: del SEARCH_POSTINGS[word]
+
+def _search_refresh(path): # re-indexes the file if it changed; False if it can't be read
+    try:
+        with open(path, "rb") as f:
+            key = _stat_key(os.fstat(f.fileno()))
+            entry = SEARCH_FILES.get(path)
+            if entry is not None and entry[0] == key: return True
+            data = f.read()
+    except OSError:
+        _search_unindex(path)
+        return False
+    _search_unindex(path)
+    lines = {}
+    for ln, text in enumerate(data.split(b"\n")):
+        for word in WORD_RE.findall(text):
+            l = lines.setdefault(word.lower(), [])
+            if not l or l[-1] != ln: l.append(ln)
+    SEARCH_FILES[path] = (key, lines)
+    for word in lines: SEARCH_POSTINGS.setdefault(word, set()).add(path)
+    return True
+
+def _search_update(path):
+    with SEARCH_LOCK:
+        if path in SEARCH_FILES: _search_refresh(path)
+
+def _search_lines(paths, query, limit): # best (index into paths, line) matches, and how many lines matched in total
+    words = _search_words(query)
+    if not words: raise RuntimeError("Search query must contain at least one word.")
+    with SEARCH_LOCK:
+        scope = {}
+        for i, path in enumerate(paths):
+            if _search_refresh(path) and path not in scope: scope[path] = i
+        scores = {}
+        for word in words:
+            holders = [path for path in SEARCH_POSTINGS.get(word, ()) if path in scope]
+            weight = math.log((1.0 + len(scope)) / (1.0 + len(holders))) + 1.0
+            for path in holders:
+                for ln in SEARCH_FILES[path][1][word]: scores[(path, ln)] = scores.get((path, ln), 0.0) + weight
+    hits = sorted(scores.items(), key=lambda h: (-h[1], scope[h[0][0]], h[0][1]))
+    return [(scope[path], ln) for (path, ln), _ in hits[:limit]], len(hits)
 
 def _setup_fsop(res, module, dgraph, accessty):
 
@@ -280,16 +514,14 @@ def _setup_fsop(res, module, dgraph, accessty):
     if accessty == "r":
         targets = _get_modules(module, module_arg, dgraph, accessty)
         if len(targets) == 0: return None, [f"No modules matched the pattern `{module_arg}`."]
-        path_arg_f = _format_re(path_arg)
-        paths = []
-        for target in targets: _populate_paths(target, path_arg_f, paths, dgraph["files"][target])
+        paths = [[target, f] for target in targets for f in dgraph.glob(target, path_arg)]
     else:
         if module_arg == ".": module_arg = module
-        if module_arg not in dgraph["modules"]:
+        if not dgraph.has_module(module_arg):
             raise RuntimeError(f"Module `{module_arg}` does not exist.")
         if not _can_write(module, module_arg, dgraph):
             raise RuntimeError(f"Module `{module}` does not have permission to write to module `{module_arg}.`")
-        if accessty == "e" and path_arg not in dgraph["files"][module_arg]:
+        if accessty == "e" and not dgraph.has_file(module_arg, path_arg):
             raise RuntimeError(f"Module `{module_arg}` does not contain file `{path_arg}`.")
         paths = [[module_arg, path_arg]]
 
@@ -338,10 +570,9 @@ def _cmd_write_append(proot, res, module, dgraph, accessty):
         _write_file(proot, module_arg, path_arg, content, accessty)
 
         # update dependency graph
-        existing_files = dgraph["files"][module_arg]
-        if path_arg not in existing_files: 
+        if not dgraph.has_file(module_arg, path_arg): 
             
-            existing_files.append(path_arg)
+            dgraph.add_file(module_arg, path_arg)
             dgraph_updated = True
 
     return [f"Content successfully written to `{paths[0][0]}/{paths[0][1]}`."], dgraph_updated
@@ -352,15 +583,32 @@ def cmd_write(proot, res, module, dgraph):
 def cmd_append(proot, res, module, dgraph):
     return _cmd_write_append(proot, res, module, dgraph, "a")
 
+def _line_arg(res, name): # int() of the argument, or -1
+    try: return int(_get_arg(res, name, -1))
+    except: return -1
+
 def cmd_read_lines(proot, res, module, dgraph):
 
     paths, problem = _setup_fsop(res, module, dgraph, "r")
     if problem is not None: return problem, False
 
+    start, count = _line_arg(res, "start_line"), _line_arg(res, "count")
+    ranged = start >= 0 or count >= 0 # without either, the whole file, as always
+    start, count = max(start, 0), count if count >= 1 else PAGE_SIZE
+
     res = []
     for path in paths:
-        lines = _read_file_lines(proot, path[0], path[1])
-        res.append(f"Contents of file `{path[0]}/{path[1]}`:\n" + "\n".join([f"Line {ln}: ```{lines[ln]}```" for ln in range(len(lines))]))
+        full_path = _get_full_path(proot, path[0], path[1])
+        offsets = _line_index(full_path)
+        total = len(offsets) - 1
+        first = min(start, total) if ranged else 0
+        last = min(first + count, total) if ranged else total
+        if ranged and first >= last:
+            res.append(f"File `{path[0]}/{path[1]}` has {total} lines.")
+            continue
+        lines = _read_line_range(full_path, offsets, first, last)
+        header = f"Contents of file `{path[0]}/{path[1]}`" + (f" (lines {first}-{last - 1} of {total})" if ranged else "") + ":\n"
+        res.append(header + "\n".join([f"Line {first + i}: ```{line}```" for i, line in enumerate(lines)]))
 
     return res, False
 
@@ -370,21 +618,53 @@ def cmd_edit(proot, res, module, dgraph):
     if problem is not None: return problem, False
 
     new_lines = _get_arg(res, "new_lines", [])
-    try: sline = int(_get_arg(res, "start_line", -1))
-    except: sline = -1
-    try: eline = int(_get_arg(res, "end_line", -1))
-    except: eline = -1
+    sline = _line_arg(res, "start_line")
+    eline = _line_arg(res, "end_line")
 
     if eline == -1: eline = sline
 
     for path in paths:
-        lines = _read_file_lines(proot, path[0], path[1])
-        if sline < 0 or eline >= len(lines) or sline > eline:
-            raise RuntimeError(f"Invalid line range [{sline, eline}] for file `{path[0]}/{path[1]}` with {len(lines)} lines.")
-        _write_file_lines(proot, path[0], path[1], "\n".join(new_lines), lines, sline, eline)
+        full_path = _get_full_path(proot, path[0], path[1])
+        offsets = _line_index(full_path)
+        if sline < 0 or eline >= len(offsets) - 1 or sline > eline:
+            raise RuntimeError(f"Invalid line range [{sline, eline}] for file `{path[0]}/{path[1]}` with {len(offsets) - 1} lines.")
+        unshare(proot, full_path)
+        _splice_lines(full_path, offsets, sline, eline, "\n".join(new_lines) + "\n")
 
     return [f"Successfully edited lines {sline}-{eline} of `{paths[0][0]}/{paths[0][1]}`."], False
 
+def cmd_search(proot, res, module, dgraph):
+
+    query = _get_arg(res, "query").strip()
+    if len(query) == 0: raise RuntimeError("Search query is missing or empty.")
+
+    module_arg = _get_arg(res, "module", "*").strip()
+    path_arg = _get_arg(res, "path", "*").strip() or "*"
+    if '/' in path_arg: raise RuntimeError(f"Illegal path argument `{path_arg}` contains the character `/`. Not allowed to create subdirectories inside a module.")
+
+    limit = _line_arg(res, "limit")
+    limit = SEARCH_LIMIT if limit < 1 else min(limit, MAX_SEARCH_LIMIT)
+    context = _line_arg(res, "context")
+    context = SEARCH_CONTEXT if context < 0 else min(context, MAX_SEARCH_CONTEXT)
+
+    targets = _get_modules(module, module_arg, dgraph, "r")
+    if len(targets) == 0: return [f"No modules matched the pattern `{module_arg}`."], False
+
+    files = [[target, f] for target in targets for f in dgraph.glob(target, path_arg)]
+    full_paths = [_get_full_path(proot, target, f) for target, f in files]
+    hits, total = _search_lines(full_paths, query, limit)
+    if len(hits) == 0: return [f"No lines matched `{query}`."], False
+
+    out = f"Found {total} matching line(s) for `{query}`" + (f", showing the best {len(hits)}" if total > len(hits) else "") + ":"
+    for i, ln in hits:
+        offsets = _line_index(full_paths[i])
+        first, last = max(0, ln - context), min(len(offsets) - 1, ln + context + 1)
+        if first >= last: continue
+        out += f"\n\n`{files[i][0]}/{files[i][1]}`, line {ln}:"
+        for n, line in enumerate(_read_line_range(full_paths[i], offsets, first, last)): out += f"\nLine {first + n}: ```{line}```"
+
+    return [out], False
+
 def cmd_query_modules(proot, res, module, dgraph):
 
     #deps = dgraph["dependencies"][module]
@@ -402,7 +682,7 @@ def cmd_create_module(proot, res, module, dgraph):
     module_arg = _get_arg(res, "module_name").strip()
 
     if len(module_arg) == 0 or module_arg.isspace(): raise RuntimeError("Module name missing or empty.")
-    if module_arg in dgraph["modules"]: raise RuntimeError(f"There is already a module named `{module_arg}`.")
+    if dgraph.has_module(module_arg): raise RuntimeError(f"There is already a module named `{module_arg}`.")
 
     '''deps_arg = _get_arg(res, "dependencies", [])
     deps_arg = [ dep.strip() for dep in deps_arg ]
@@ -411,11 +691,8 @@ def cmd_create_module(proot, res, module, dgraph):
         if not (dep in dgraph["dependencies"][module] or dep in dgraph["children"][module] or dep == module):
             raise RuntimeError(f"Invalid dependency module `{dep}`.")'''
 
-    dgraph["modules"].append(module_arg)
     #dgraph["dependencies"][module_arg] = deps_arg
-    dgraph["children"][module_arg] = []
-    dgraph["files"][module_arg] = []
-    dgraph["children"][module].append(module_arg)
+    dgraph.add_module(module, module_arg)
     #print(f"Updated dgraph = {dgraph}")
     return [f"Successfully created module `{module_arg}`."], True
 
@@ -437,6 +714,8 @@ DEFAULT_ACTIONS = {
     "read_lines": cmd_read_lines,
     "edit": cmd_edit,
     "query_modules": cmd_query_modules,
+    "search": cmd_search,
     "create_module": cmd_create_module,
     "answer": cmd_answer
-}
\ No newline at end of file
+}
+READ_ONLY_ACTIONS = { "no_op", "list", "read", "read_lines", "query_modules", "search", "answer" } # may run concurrently on the same project
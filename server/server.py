@@ -1,17 +1,78 @@
 
-from fsop import DEFAULT_COMMANDS, DEFAULT_ACTIONS
+import time
+STARTED = time.perf_counter() # startup time is reported from here; see signal_ready()
 
-def load_commands(): # loads a dictionary of all existing commands; both default and plugins (TODO)
+from fsop import DEFAULT_COMMANDS, DEFAULT_ACTIONS, READ_ONLY_ACTIONS, DependencyGraph, unshare_writable
+import threading, hashlib, importlib.util, os, json
 
-    commands = DEFAULT_COMMANDS
-    return commands
-
-ALL_COMMANDS = load_commands()
+ALL_COMMANDS = DEFAULT_COMMANDS
 ALL_LEGAL_COMMANDS = { k: ALL_COMMANDS[k] for k in ALL_COMMANDS.keys() if k != "answer" }
 
-def get_commands(): # returns a dictionary of all installed HLL commands
+def get_commands(): # returns a dictionary of the built-in HLL commands; plugins are per project, see load_plugins
     return { "status": "ok", "data": ALL_COMMANDS }
 
+# plugins: every `*.py` file in a project's `.hll/plugins` directory (copied there from `plugins` next to the dialogues
+# when the project is created) defines
+#  - COMMANDS: name -> function declaration, in the same format as fsop.DEFAULT_COMMANDS
+#  - ACTIONS: name -> fn(project_root, args, module, dgraph) returning (list of output strings, whether dgraph changed),
+#    the same signature as fsop.DEFAULT_ACTIONS; dgraph is a fsop.DependencyGraph, so use its add_file/add_module
+#    project files may be hard links shared through the content store (src/store.cpp); before a plugin action runs, the
+#    files its module may write are given their own copies (fsop.unshare_writable), so plugins can write them as usual
+# the schema hash identifies the set of declarations; the client caches declarations on disk and only asks for them
+# (load_plugins) when the plugin files change, and sends the hash it parsed with along with every plugin call
+
+class PluginRegistry:
+
+    def __init__(self, directory=None, fingerprint=None): # no directory: a project without plugins
+        self.fingerprint = fingerprint
+        self.commands = {}
+        self.actions = {}
+
+        for name in (sorted(os.listdir(directory)) if directory else []):
+            if not name.endswith(".py"): continue
+            spec = importlib.util.spec_from_file_location(f"hll_plugin_{hashlib.sha1(directory.encode()).hexdigest()[:8]}_{name[:-3]}", os.path.join(directory, name))
+            module = importlib.util.module_from_spec(spec)
+            spec.loader.exec_module(module)
+
+            for cmd, decl in getattr(module, "COMMANDS", {}).items():
+                if cmd in DEFAULT_COMMANDS: raise RuntimeError(f"Plugin `{name}` redefines the built-in command `{cmd}`")
+                if cmd in self.commands: raise RuntimeError(f"Plugin `{name}` redefines the command `{cmd}`")
+                if cmd not in getattr(module, "ACTIONS", {}): raise RuntimeError(f"Plugin `{name}` declares `{cmd}` but doesn't implement it")
+                self.commands[cmd] = decl
+                self.actions[cmd] = module.ACTIONS[cmd]
+
+        self.schema_hash = hashlib.sha256(json.dumps(self.commands, sort_keys=True).encode()).hexdigest()[:16] if self.commands else ""
+
+PLUGINS = {} # plugin directory -> PluginRegistry
+PLUGINS_GUARD = threading.Lock()
+NO_PLUGINS = PluginRegistry()
+
+def plugin_fingerprint(directory): # changes whenever a plugin file is added, removed or modified
+    entries = []
+    for name in sorted(os.listdir(directory)):
+        if not name.endswith(".py"): continue
+        st = os.stat(os.path.join(directory, name))
+        entries.append((name, st.st_size, st.st_mtime_ns))
+    return entries
+
+def plugins_in(directory): # the registry for a plugin directory, (re)loaded if its files changed
+    directory = os.path.normpath(directory)
+    if not os.path.isdir(directory): return NO_PLUGINS
+    fingerprint = plugin_fingerprint(directory)
+    with PLUGINS_GUARD:
+        registry = PLUGINS.get(directory)
+        if registry is None or registry.fingerprint != fingerprint:
+            registry = PluginRegistry(directory, fingerprint)
+            PLUGINS[directory] = registry
+        return registry
+
+def project_plugins(proot): return plugins_in(os.path.join(proot, ".hll", "plugins"))
+
+def load_plugins(data):
+    try: registry = plugins_in(get_arg(data, "plugin_dir"))
+    except Exception as e: return { "status": "err", "reason": f"Failed to load plugins: {e}" }
+    return { "status": "ok", "data": { "commands": registry.commands, "schema_hash": registry.schema_hash } }
+
 def convert_fsop_output(items):
 
     return [
@@ -40,26 +101,21 @@ def run_agent_action(content, partidx, proot, module, dgraph, default_params, ex
         if actname not in expecting:
             raise RuntimeError(f"Agent was suppposed to call one of the following functions: `{'`, `'.join(expecting)}` in this reply, but instead attempted to call `{actname}`.")
 
-        if actname == "answer":
-
-            res = DEFAULT_ACTIONS["answer"](None, res, None, None)
-            return True, newctx, res, None
+        if actname in DEFAULT_COMMANDS: # built-in actions (including `answer`) are executed natively by the client; see actions.cpp
 
-        elif actname in DEFAULT_COMMANDS:
+            return True, newctx, None, { "name": actname, "args": res }
 
-            res, update_dgraph = DEFAULT_ACTIONS[actname](proot, res, module, dgraph)
-            newctx.extend(
-                convert_fsop_output(res)
-            )
-            return True, newctx, None, update_dgraph
+        action = project_plugins(proot).actions.get(actname)
+        if action is None: raise RuntimeError(f"Unknown action `{actname}`.")
+        out, _ = action(proot, res, module, dgraph)
+        newctx.extend(convert_fsop_output(out))
+        return True, newctx, None, None
 
     except Exception as e:
         newctx.extend(
             convert_fsop_output([f"Error: {str(e)}"])
         )
-        return False, newctx, False, False
-
-    raise RuntimeError("Custom actions not yet implemented.")
+        return False, newctx, False, None
 
 
 def get_arg(d, a):
@@ -67,6 +123,74 @@ def get_arg(d, a):
     try: return d[a]
     except: raise RuntimeError(f"Required argument `{a}` is missing from request")
 
+# dependency graphs are owned by the server; clients refer to them by id and version (see graph.cpp)
+
+GRAPHS = {} # graph id -> DependencyGraph
+
+RESYNC = { "status": "resync" } # the client resends the request with the full graph attached
+
+def resolve_graph(data): # returns the graph a request operates on, or None if the client has to send it in full
+
+    gid = get_arg(data, "graph_id")
+    version = get_arg(data, "graph_version")
+
+    if "dependency_graph" in data:
+        graph = DependencyGraph(data["dependency_graph"])
+        graph["version"] = version
+        GRAPHS[gid] = graph
+        return graph
+
+    graph = GRAPHS.get(gid)
+    if graph is None or graph["version"] != version: return None
+    return graph
+
+def attach_graph_delta(r, graph): # moves the graph to a new version if the request changed it
+    if len(graph.delta) == 0: return
+    graph["version"] += 1
+    if r["status"] == "ok":
+        r["data"]["graph_delta"] = graph.delta
+        r["data"]["graph_version"] = graph["version"]
+    else: GRAPHS.pop(graph.get("id"), None) # the client won't learn about these changes, so make it resend its graph
+    graph.delta = []
+
+# requests run on a pool of worker threads (see serve_request), so everything that touches a project's files or its
+# graph holds that project's lock: shared for read-only actions, exclusive for anything that can change the graph,
+# because a graph collects the delta of the request currently changing it
+
+class ProjectLock:
+
+    def __init__(self):
+        self.cond = threading.Condition()
+        self.readers = 0
+        self.writer = False
+
+    def acquire(self, exclusive):
+        with self.cond:
+            if exclusive:
+                while self.writer or self.readers > 0: self.cond.wait()
+                self.writer = True
+            else:
+                while self.writer: self.cond.wait()
+                self.readers += 1
+
+    def release(self, exclusive):
+        with self.cond:
+            if exclusive: self.writer = False
+            else: self.readers -= 1
+            self.cond.notify_all()
+
+PROJECT_LOCKS = {} # project root -> ProjectLock
+PROJECT_LOCKS_GUARD = threading.Lock()
+
+class project_lock:
+
+    def __init__(self, proot, exclusive):
+        with PROJECT_LOCKS_GUARD: self.lock = PROJECT_LOCKS.setdefault(proot, ProjectLock())
+        self.exclusive = exclusive
+
+    def __enter__(self): self.lock.acquire(self.exclusive)
+    def __exit__(self, *_): self.lock.release(self.exclusive)
+
 def agent_messed_up(content, reason):
     return {
         "status": "ok",
@@ -76,19 +200,58 @@ def agent_messed_up(content, reason):
         }
     }
 
+def called_action(response): # name of the function the reply calls, if any
+    try:
+        for part in response["candidates"][0]["content"]["parts"]:
+            if "functionCall" in part: return part["functionCall"]["name"]
+    except Exception: pass
+    return None
+
 def handle_agent(data):
 
+    try: response = json.loads(get_arg(data, "response")) # data is passed from client still in string form to prevent a needless conversion to/from JSON
+    except Exception as e: return { "status": "err", "reason": str(e) }
+
+    dgraph = None
+    called = called_action(response)
+    if called is not None and called not in DEFAULT_COMMANDS: # only plugins run here and need the dependency graph
+
+        try:
+            proot = get_arg(data, "project_root")
+            registry = project_plugins(proot)
+        except Exception as e: return { "status": "err", "reason": str(e) }
+
+        if "schema_hash" in data and data["schema_hash"] != registry.schema_hash:
+            return { "status": "err", "reason": "The project's plugins changed since its dialogues were parsed; run it again to pick up the new commands." }
+
+        with project_lock(proot, True):
+            try: dgraph = resolve_graph(data)
+            except Exception as e: return { "status": "err", "reason": str(e) }
+            if dgraph is None: return RESYNC
+
+            try: unshare_writable(proot, get_arg(data, "module"), dgraph)
+            except Exception as e: return { "status": "err", "reason": str(e) }
+            r = _handle_agent(data, response, dgraph)
+            attach_graph_delta(r, dgraph)
+
+    else: r = _handle_agent(data, response, dgraph)
+
+    # token accounting for the client's context budget manager
+    if r["status"] == "ok" and "usageMetadata" in response: r["data"]["usage"] = response["usageMetadata"]
+
+    return r
+
+def _handle_agent(data, response, dgraph):
+
     try:
 
         rtype = get_arg(data, "response_type")
         proot = get_arg(data, "project_root")
         module = get_arg(data, "module")
-        dgraph = get_arg(data, "dependency_graph")
         default_params = get_arg(data, "default_parameters") # for handle_agent, actions is a dict, not a list like in run_user_action; this is because the actions have a slightly different meaning in this context
         expecting = get_arg(data, "expecting")
         if len(expecting) == 0: expecting = ALL_LEGAL_COMMANDS
-        data = get_arg(data, "response")
-        data = json.loads(data) # data is passed from client still in string form to prevent a needless conversion to/from JSON
+        data = response
     
     except Exception as e:
         return { "status": "err", "reason": str(e) }
@@ -131,9 +294,9 @@ def handle_agent(data):
 
     if not expecting_fncall and textidx < 0: return agent_messed_up(content, "No text content found in reply.")
 
-    if rtype == "action": 
+    if rtype in [ "action", "branch" ]: 
 
-        success, newctx, _, update_dgraph = run_agent_action(
+        success, newctx, ans, native = run_agent_action(
             content,
             callidx,
             proot,
@@ -151,30 +314,10 @@ def handle_agent(data):
             }
         }
 
-        if update_dgraph: r["data"]["dependency_graph"] = dgraph
-        
-        return r
-    
-    elif rtype == "branch":
+        if native is not None: r["data"]["native_action"] = native
+        elif rtype == "branch": r["data"]["answer"] = ans
 
-        success, newctx, ans, _ = run_agent_action(
-            content,
-            callidx,
-            proot,
-            module,
-            dgraph,
-            default_params,
-            expecting
-        )
-    
-        return { 
-            "status": "ok",
-            "data": {
-                "new_context": newctx,
-                "answer": ans,
-                "agent_error": not success
-            }
-        }
+        return r
 
     else: 
         
@@ -192,12 +335,27 @@ def run_user_action(data):
 
         proot = get_arg(data, "project_root")
         module = get_arg(data, "module")
-        dgraph = get_arg(data, "dependency_graph")
         actions = get_arg(data, "actions")
+        exclusive = any(action.get("name") not in READ_ONLY_ACTIONS for action in actions)
     
     except Exception as e:
         return { "status": "err", "reason": str(e) }
 
+    with project_lock(proot, exclusive):
+
+        try: dgraph = resolve_graph(data)
+        except Exception as e: return { "status": "err", "reason": str(e) }
+        if dgraph is None: return RESYNC
+
+        if any(action.get("name") not in DEFAULT_ACTIONS for action in actions): # plugins
+            try: unshare_writable(proot, module, dgraph)
+            except Exception as e: return { "status": "err", "reason": str(e) }
+        r = _run_user_action(proot, module, dgraph, actions)
+        attach_graph_delta(r, dgraph)
+        return r
+
+def _run_user_action(proot, module, dgraph, actions):
+
     newctx = []
 
     for action in actions:
@@ -206,36 +364,51 @@ def run_user_action(data):
 
             name = get_arg(action, "name")
             args = get_arg(action, "args")
-            res, update_dgraph = DEFAULT_ACTIONS[name](proot, args, module, dgraph)
+            action = DEFAULT_ACTIONS.get(name) or project_plugins(proot).actions.get(name)
+            if action is None: raise RuntimeError(f"Unknown action `{name}`")
+            res, update_dgraph = action(proot, args, module, dgraph)
 
         except Exception as e:
             return { "status": "err", "reason": str(e) }
 
         newctx.extend(res)
 
-    r = {
+    return {
         "status": "ok",
         "data": {
             "new_context": convert_fsop_output(newctx)
         }
     }
-
-    if update_dgraph: r["data"]["dependency_graph"] = dgraph
-
-    return r
     
 # main server loop; code below was mostly written by chatgpt
 
-import asyncio, signal, os, struct, json
+import asyncio, signal, struct, random, logging, socket
+from concurrent.futures import ThreadPoolExecutor
+from logging.handlers import RotatingFileHandler, QueueHandler, QueueListener
+import queue
 
 SOCKET_PATH = "/tmp/hll_socket.sock"
 HLL_DIR = os.path.expanduser("~/.local/share/hll/")
 PIDFILE = "/tmp/hll_server.pid"
 
+# systemd-style socket activation: the listening socket is inherited as fd 3 (see hll-server.socket)
+SD_LISTEN_FDS_START = 3
+ACTIVATED = os.environ.get("LISTEN_PID") == str(os.getpid()) and int(os.environ.get("LISTEN_FDS", "0")) >= 1
+
 # Clean up old socket if exists
-if os.path.exists(SOCKET_PATH):
+if not ACTIVATED and os.path.exists(SOCKET_PATH):
     os.remove(SOCKET_PATH)
 
+def signal_ready(): # tells the client that started us that the socket is listening, instead of making it poll connect()
+    startup_ms = (time.perf_counter() - STARTED) * 1000
+    print(f"Listening after {startup_ms:.1f} ms{' (socket activated)' if ACTIVATED else ''}\n\n")
+    fd = os.environ.pop("HLL_READY_FD", None)
+    if fd is None: return
+    try:
+        os.write(int(fd), f"ready {startup_ms:.1f}\n".encode())
+        os.close(int(fd))
+    except (OSError, ValueError) as e: print(f"Failed to signal readiness: {e}")
+
 # Helper: read exactly n bytes
 async def recv_all(reader, n):
     data = b''
@@ -246,41 +419,236 @@ async def recv_all(reader, n):
         data += chunk
     return data
 
-async def handle_client(reader, writer):
+# see unix_socket_client.cpp; version 2 frames carry a request id after the length, version 3 frames may carry a
+# reference to a payload in shared memory instead of the payload itself
+SHM_DIR = "/dev/shm" # where POSIX shared memory objects live on Linux
+SHM_FLAG = 0x80000000
+PROTOCOL_VERSION = 3 if os.path.isdir(SHM_DIR) else 2
+
+class Connection:
+
+    def __init__(self):
+        self.protocol = 1
+        self.shm_sent = set() # responses passed in shared memory; whatever the client didn't pick up is removed on close
+
+    def close(self):
+        for name in self.shm_sent:
+            try: os.unlink(shm_path(name))
+            except FileNotFoundError: pass
+
+# the event loop only moves frames; requests are handled on a pool of worker threads (file I/O releases the GIL, so a
+# large read no longer stalls every other client). at most MAX_PENDING requests are queued or running at once; beyond
+# that the server answers "busy" without doing anything, and the client waits `retry_after_ms` and sends it again
+
+def env_int(name, default):
+    try: return max(1, int(os.environ.get(name, default)))
+    except ValueError: return default
+
+WORKERS = env_int("HLL_SERVER_WORKERS", min(32, (os.cpu_count() or 1) + 4))
+MAX_PENDING = env_int("HLL_SERVER_QUEUE", WORKERS * 8)
+BUSY_RETRY_MS = 20
+
+executor = ThreadPoolExecutor(max_workers=WORKERS, thread_name_prefix="hll-worker")
+pending_requests = 0 # only touched on the event loop thread
+
+def busy():
+    return { "status": "busy", "retry_after_ms": BUSY_RETRY_MS * max(1, pending_requests // WORKERS) }
+
+def dispatch(request_type, data):
+
+    if request_type == "ping": # echoes its data, so payloads of any size can be timed (see bench_ipc.cpp)
+        response = { "status": "ok", "data": data }
+    elif request_type == "get_commands":
+        response = get_commands()
+    elif request_type == "load_plugins":
+        response = load_plugins(data)
+    elif request_type == "handle_agent":
+        response = handle_agent(data)
+    elif request_type == "run_user_action":
+        response = run_user_action(data)
+    else:
+        response = { "status": "err", "reason": f"Unrecognized request `{request_type}`" }
+
+    return response
+
+# request log: one JSON object per line in hll_requests.log, rotated by size. every request except pings gets a line
+# with its type, sizes, status and a timing breakdown in milliseconds:
+#  - decode: parsing the request frame
+#  - queue: waiting for a worker
+#  - handle: running the request
+#  - encode: serializing the response
+#  - total: from the end of the read to the response being handed to the socket
+# payloads are left out (they hold whole dependency graphs and model responses) except for a random sample of
+# requests, and for failed requests, truncated to LOG_PAYLOAD_BYTES
+
+def env_float(name, default):
+    try: return float(os.environ.get(name, default))
+    except ValueError: return default
+
+LOG_SAMPLE = env_float("HLL_SERVER_LOG_SAMPLE", 0) # fraction of requests logged with their payload
+LOG_PAYLOAD_BYTES = 4096
+LOG_MAX_BYTES = int(env_float("HLL_SERVER_LOG_MB", 16) * 1024 * 1024)
+LOG_BACKUPS = 3
+
+request_log = logging.getLogger("hll.requests")
+request_log.propagate = False
+request_log.setLevel(logging.INFO)
+
+def setup_request_log(): # lines are written to the file on a background thread, never on the event loop; returns that thread
+    handler = RotatingFileHandler(os.path.join(HLL_DIR, "hll_requests.log"), maxBytes=LOG_MAX_BYTES, backupCount=LOG_BACKUPS)
+    handler.setFormatter(logging.Formatter("%(message)s"))
+    records = queue.SimpleQueue()
+    request_log.addHandler(QueueHandler(records))
+    listener = QueueListener(records, handler)
+    listener.start()
+    return listener
+
+def ms(start, end): return round((end - start) * 1000, 3)
+
+def log_request(trace, request_type, data, response, out_bytes):
+
+    status = response["status"]
+    entry = {
+        "ts": round(time.time(), 3),
+        "request": request_type,
+        "status": status,
+        "bytes_in": trace["bytes_in"],
+        "bytes_out": out_bytes,
+        "decode_ms": trace["decode_ms"]
+    }
+    if "start" in trace: # handled by a worker
+        entry["queue_ms"] = ms(trace["read"], trace["start"])
+        entry["handle_ms"] = ms(trace["start"], trace["done"])
+    entry["encode_ms"] = ms(trace["encoded_from"], trace["encoded"])
+    entry["total_ms"] = ms(trace["read"], trace["encoded"])
+    if isinstance(data, dict):
+        if "project_root" in data: entry["project"] = data["project_root"]
+        if isinstance(data.get("actions"), list): entry["actions"] = [ a.get("name") for a in data["actions"] if isinstance(a, dict) ]
+    if status == "err": entry["reason"] = response.get("reason")
+    if status == "err" or (LOG_SAMPLE > 0 and random.random() < LOG_SAMPLE):
+        entry["payload"] = json.dumps(data)[:LOG_PAYLOAD_BYTES]
+
+    request_log.info(json.dumps(entry))
+
+def timed_dispatch(trace, request_type, data): # runs on a worker thread
+    trace["start"] = time.perf_counter()
+    try: return dispatch(request_type, data)
+    finally: trace["done"] = time.perf_counter()
+
+def env_bytes(name, default):
+    try: return max(0, int(os.environ.get(name, default)))
+    except ValueError: return default
+
+SHM_THRESHOLD = env_bytes("HLL_IPC_SHM_BYTES", 1 << 20) # responses at least this large go through shared memory; 0 disables
+shm_counter = 0
+
+def shm_path(name): return os.path.join(SHM_DIR, name.lstrip("/"))
+
+def shm_load(ref): # reads and removes the payload behind a reference frame
+    ref = json.loads(ref)
+    name = ref["shm"]
+    if not name.startswith("/hll_ipc_") or "/" in name[1:]: raise ValueError(f"Invalid shared memory reference `{name}`")
+    path = shm_path(name)
+    with open(path, "rb") as f: raw = f.read(ref["size"])
+    os.unlink(path)
+    return raw
+
+def shm_store(encoded):
+    global shm_counter
+    shm_counter += 1
+    name = f"/hll_ipc_s{os.getpid()}_{shm_counter}"
+    fd = os.open(shm_path(name), os.O_CREAT | os.O_EXCL | os.O_WRONLY, 0o600)
+    with os.fdopen(fd, "wb") as f: f.write(encoded)
+    return name
+
+def sweep_shm(): # payloads left behind by clients or a server that died; nothing can be in flight before we listen
+    if PROTOCOL_VERSION < 3: return
+    for entry in os.listdir(SHM_DIR):
+        if entry.startswith("hll_ipc_"):
+            try: os.unlink(os.path.join(SHM_DIR, entry))
+            except OSError: pass
+
+async def read_frame(reader, conn): # returns (request id, message, trace), or None if the client closed the connection between requests
+    try: raw_len = await reader.readexactly(4)
+    except asyncio.IncompleteReadError as e:
+        if len(e.partial) == 0: return None
+        raise ConnectionError("Connection closed while reading data")
+    msg_len = struct.unpack('!I', raw_len)[0]
+    shm = conn.protocol >= 3 and (msg_len & SHM_FLAG) != 0
+    msg_len &= ~SHM_FLAG
+    rid = None
+    if conn.protocol >= 2:
+        rid = struct.unpack('!I', await recv_all(reader, 4))[0]
+        msg_len -= 4
+    raw = await recv_all(reader, msg_len)
+    start = time.perf_counter()
+    if shm:
+        raw = shm_load(raw)
+        msg_len = len(raw)
+    message = json.loads(raw.decode())
+    read = time.perf_counter()
+    return rid, message, { "bytes_in": msg_len, "decode_ms": ms(start, read), "read": read }
+
+def encode_frame(rid, response, conn):
+    encoded = json.dumps(response).encode()
+    if rid is None: return struct.pack('!I', len(encoded)) + encoded
+    if conn.protocol >= 3 and SHM_THRESHOLD > 0 and len(encoded) >= SHM_THRESHOLD:
+        name = shm_store(encoded)
+        conn.shm_sent.add(name)
+        ref = json.dumps({ "shm": name, "size": len(encoded) }).encode()
+        return struct.pack('!II', (len(ref) + 4) | SHM_FLAG, rid) + ref
+    return struct.pack('!II', len(encoded) + 4, rid) + encoded
+
+async def serve_request(writer, conn, rid, request_type, data, trace):
+    global pending_requests
+    if request_type == "ping": response = dispatch(request_type, data)
+    elif pending_requests >= MAX_PENDING: response = busy()
+    else:
+        pending_requests += 1
+        try: response = await asyncio.get_running_loop().run_in_executor(executor, timed_dispatch, trace, request_type, data)
+        except Exception as e: response = { "status": "err", "reason": f"HLL Server Error: {e}" }
+        finally: pending_requests -= 1
+    trace["encoded_from"] = time.perf_counter()
+    frame = encode_frame(rid, response, conn)
+    trace["encoded"] = time.perf_counter()
+    writer.write(frame) # one write per frame, so concurrently finishing requests never interleave
+    if request_type != "ping":
+        try: log_request(trace, request_type, data, response, len(frame))
+        except Exception as e: print(f"Failed to log request: {e}")
+    await writer.drain()
+
+async def handle_client(reader, writer): # serves requests on one connection until the client closes it
+    conn = Connection()
+    pending = set()
     try:
-        raw_len = await recv_all(reader, 4)
-        msg_len = struct.unpack('!I', raw_len)[0]
-        raw_json = await recv_all(reader, msg_len)
-        data = json.loads(raw_json.decode())
-        print(f"Received JSON: {data}")
-
-        request_type = data["request"]
-        data = data["data"]
-
-        if request_type == "get_commands":
-            response = get_commands()
-        elif request_type == "handle_agent":
-            response = handle_agent(data)
-        elif request_type == "run_user_action":
-            response = run_user_action(data)
-        else:
-            response = { "status": "err", "reason": f"Unrecognized request `{request_type}`" }
-
-        if response["status"] == "ok":
-            print("\nHandled request with no issues\n\n")
-        else:
-            print(f"\nFailed to handle request: {response['reason']}\n\n")
-
-        encoded = json.dumps(response).encode()
-        writer.write(struct.pack('!I', len(encoded)))
-        writer.write(encoded)
-        await writer.drain()
+        while True:
+            frame = await read_frame(reader, conn)
+            if frame is None: break
+            rid, data, trace = frame
+
+            request_type = data["request"]
+            data = data["data"]
+
+            if request_type == "hello": # protocol negotiation; answered in the framing the request came in
+                protocol = min(int(data.get("protocol", 1)), PROTOCOL_VERSION)
+                writer.write(encode_frame(rid, { "status": "ok", "data": { "protocol": protocol } }, conn))
+                conn.protocol = protocol
+                await writer.drain()
+            elif conn.protocol >= 2: # responses go out as they complete, tagged with the request id
+                task = asyncio.create_task(serve_request(writer, conn, rid, request_type, data, trace))
+                pending.add(task)
+                task.add_done_callback(pending.discard)
+            else:
+                await serve_request(writer, conn, rid, request_type, data, trace)
+
+        if pending: await asyncio.gather(*pending, return_exceptions=True)
 
     except (ConnectionResetError, BrokenPipeError):
         print("Client disconnected before response could be sent.")
     except Exception as e:
         print(f"HLL Server Error: {e}")
     finally:
+        conn.close()
         try:
             writer.close()
             await writer.wait_closed()
@@ -298,16 +666,22 @@ signal.signal(signal.SIGTERM, _sigterm)
 async def main():
     # === Write the PID file ===
     with open(PIDFILE, "w") as f:
-        f.write(str(os.getpid()))
+        f.write(str(os.getpid()) + ("\nactivated" if ACTIVATED else "")) # kill_server leaves systemd's socket in place
         f.flush()
         os.fsync(f.fileno())
     print(f"Server PID written to {PIDFILE}\n\n")
+    log_writer = setup_request_log()
+    sweep_shm()
 
     try:
-        server = await asyncio.start_unix_server(handle_client, path=SOCKET_PATH)
+        if ACTIVATED: server = await asyncio.start_unix_server(handle_client, sock=socket.socket(fileno=SD_LISTEN_FDS_START))
+        else: server = await asyncio.start_unix_server(handle_client, path=SOCKET_PATH)
+        signal_ready()
         async with server:
             await stop_event.wait()        # run until SIGTERM
         await server.wait_closed()         # graceful shutdown
+        executor.shutdown(wait=True)
+        log_writer.stop()
     finally:
         # === Always clean up the PID file on exit ===
         try:
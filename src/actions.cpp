@@ -0,0 +1,555 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <functional>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "defs.hpp"
+#include "json.hpp"
+#include "actions.hpp"
+#include "commands.hpp"
+#include "metrics.hpp"
+
+/*
+native built-in actions
+
+these used to live in server/fsop.py, which meant every action cost a round trip to the python server, a JSON encode and
+decode on both sides and python file I/O. they are implemented here with the same semantics, permission checks and
+messages (the agent learns the API from them, so they are kept word for word), and the interpreter calls them directly.
+
+ - every module may read every module; a module may write to itself, to its children and to `global`
+ - reads accept `*` wildcards in the file name and the module patterns `.`, `.children` and `*`
+ - file names may not contain `/`
+ - search looks lines up in the inverted index in search.cpp, which write, append and edit keep current
+ - read is served from the file cache in filecache.cpp while the file is unchanged
+ - in projects with a content store (store.cpp), write links the file to the blob for its content; append and edit
+   give a shared file a private copy before changing it
+
+read_lines and edit work from a line index: the byte offset of every line of a file, kept per path and rescanned only
+when the file's inode, size or mtime changes. read_lines reads and formats only the requested range, and edit splices the
+replacement over the byte range of the edited lines (the file's tail is moved, the head is never rewritten) and shifts
+the cached offsets instead of rescanning.
+*/
+
+extern void graphaddfile(pjson dgraph, const std::string& module, const std::string& file); // graph.cpp
+extern void graphaddmodule(pjson dgraph, const std::string& parent, const std::string& module);
+extern bool graphhasmodule(pjson dgraph, const std::string& module); // indexed lookups
+extern bool graphhasfile(pjson dgraph, const std::string& module, const std::string& file);
+extern bool graphcanwrite(pjson dgraph, const std::string& module, const std::string& target);
+extern std::vector<std::string> graphglob(pjson dgraph, const std::string& module, const std::string& pattern);
+extern void searchupdate(const std::string& path); // search.cpp
+extern bool storeput(const std::string& proot, const std::string& module, const std::string& file, const std::string& content); // store.cpp
+extern void storeunshare(const std::string& proot, const std::string& module, const std::string& file, bool keepcontent);
+extern std::vector<std::pair<size_t, long>> searchlines(const std::vector<std::string>& paths, const std::string& query, size_t limit, size_t& total);
+extern bool cachedread(const std::string& path, const std::string& header, std::string& out); // filecache.cpp
+extern void filecacheforget(const std::string& path);
+extern void snapshotchanged(const std::string& module, const std::string& file); // snapshot.cpp
+
+pjson builtincommands() {
+    static pjson commands = json::loadFromString(BUILTIN_COMMANDS);
+    return commands;
+}
+
+bool isbuiltinaction(const std::string& name) { return builtincommands()->getDict().count(name) > 0; }
+
+std::string strip(const std::string& s) { // same character set as python's str.strip()
+    const char* ws = " \t\n\r\v\f";
+    auto b = s.find_first_not_of(ws);
+    if (b == std::string::npos) return "";
+    return s.substr(b, s.find_last_not_of(ws) - b + 1);
+}
+
+std::string getarg(pjson args, const std::string& name, const std::string& fallback = "") {
+    auto& a = args->getDict();
+    auto it = a.find(name);
+    if (it == a.end()) return fallback;
+    if (it->second->getDtype() != json::dtype::lstring) throw std::runtime_error("Argument `" + name + "` must be a string.");
+    return it->second->getString();
+}
+
+std::vector<std::string> strings(pjson l) {
+    std::vector<std::string> out;
+    for (const auto& e : l->getList()) out.push_back(e->getString());
+    return out;
+}
+
+std::string joinstrings(const std::vector<std::string>& v, const std::string& sep) {
+    std::string out;
+    for (size_t i = 0; i < v.size(); i++) {
+        if (i > 0) out += sep;
+        out += v[i];
+    }
+    return out;
+}
+
+std::runtime_error oserror(const std::string& path) { // worded like python's OSError, which is what agents used to see
+    int e = errno;
+    return std::runtime_error("[Errno " + std::to_string(e) + "] " + std::strerror(e) + ": '" + path + "'");
+}
+
+std::string fullpath(const std::string& proot, const std::string& target, const std::string& path) {
+    if (target == "global") return proot + path;
+    return proot + target + "/" + path;
+}
+
+// line index
+
+const long PAGE_SIZE = 50; // lines read_lines returns when given a start but no count
+const long SEARCH_LIMIT = 20, MAX_SEARCH_LIMIT = 100; // matches search returns
+const long SEARCH_CONTEXT = 1, MAX_SEARCH_CONTEXT = 5; // lines shown around each match
+
+struct lineindex {
+    ino_t inode = 0;
+    off_t size = -1;
+    struct timespec mtime = {};
+    std::vector<uint64_t> offsets; // start of every line, then the file size; lines keep their newline, like readlines()
+
+    long count() const { return (long)offsets.size() - 1; }
+
+    bool current(const struct stat& st) const {
+        return inode == st.st_ino && size == st.st_size && mtime.tv_sec == st.st_mtim.tv_sec && mtime.tv_nsec == st.st_mtim.tv_nsec;
+    }
+
+    void stamp(const struct stat& st) {
+        inode = st.st_ino;
+        size = st.st_size;
+        mtime = st.st_mtim;
+    }
+};
+
+std::unordered_map<std::string, lineindex> lineindices;
+const size_t MAX_LINE_INDICES = 64;
+
+struct fdcloser {
+    int fd;
+    ~fdcloser() { if (fd >= 0) ::close(fd); }
+};
+
+void preadall(int fd, char* buf, size_t n, uint64_t at, const std::string& path) {
+    while (n > 0) {
+        ssize_t r = ::pread(fd, buf, n, at);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) throw oserror(path);
+        buf += r; n -= r; at += r;
+    }
+}
+
+void pwriteall(int fd, const char* buf, size_t n, uint64_t at, const std::string& path) {
+    while (n > 0) {
+        ssize_t w = ::pwrite(fd, buf, n, at);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) throw oserror(path);
+        buf += w; n -= w; at += w;
+    }
+}
+
+lineindex& linesof(const std::string& path) { // the file's line index, rescanned if the file changed since it was taken
+
+    fdcloser f{ ::open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    struct stat st;
+    if (f.fd < 0 || ::fstat(f.fd, &st) != 0) throw oserror(path);
+
+    auto it = lineindices.find(path);
+    if (it != lineindices.end() && it->second.current(st)) return it->second;
+    if (it == lineindices.end() && lineindices.size() >= MAX_LINE_INDICES) lineindices.clear();
+
+    auto& idx = lineindices[path];
+    idx.offsets.assign(1, 0);
+    std::vector<char> buf(1 << 20);
+    uint64_t at = 0;
+    for (;;) {
+        ssize_t r = ::read(f.fd, buf.data(), buf.size());
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) { lineindices.erase(path); throw oserror(path); }
+        if (r == 0) break;
+        for (const char* p = buf.data(); (p = (const char*)std::memchr(p, '\n', buf.data() + r - p)); p++) idx.offsets.push_back(at + (p - buf.data()) + 1);
+        at += r;
+    }
+    if (idx.offsets.back() != at) idx.offsets.push_back(at);
+    idx.stamp(st);
+    metricadd("actions.line_index_scans");
+    return idx;
+
+}
+
+std::string readlinerange(const std::string& path, const lineindex& idx, long first, long last) { // lines [first, last), newlines included
+    fdcloser f{ ::open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if (f.fd < 0) throw oserror(path);
+    std::string out(idx.offsets[last] - idx.offsets[first], '\0');
+    preadall(f.fd, out.data(), out.size(), idx.offsets[first], path);
+    return out;
+}
+
+void splicelines(const std::string& path, lineindex& idx, long sline, long eline, const std::string& replacement) { // replaces lines [sline, eline]
+
+    fdcloser f{ ::open(path.c_str(), O_RDWR | O_CLOEXEC) };
+    if (f.fd < 0) throw oserror(path);
+
+    uint64_t from = idx.offsets[sline], to = idx.offsets[eline + 1], size = idx.offsets.back();
+    if (replacement.size() == to - from) pwriteall(f.fd, replacement.data(), replacement.size(), from, path);
+    else {
+        std::string tail(size - to, '\0');
+        preadall(f.fd, tail.data(), tail.size(), to, path);
+        pwriteall(f.fd, replacement.data(), replacement.size(), from, path);
+        pwriteall(f.fd, tail.data(), tail.size(), from + replacement.size(), path);
+        if (::ftruncate(f.fd, from + replacement.size() + tail.size()) != 0) throw oserror(path);
+    }
+
+    struct stat st;
+    if (::fstat(f.fd, &st) != 0) { lineindices.erase(path); throw oserror(path); }
+
+    int64_t delta = (int64_t)replacement.size() - (int64_t)(to - from);
+    std::vector<uint64_t> offsets(idx.offsets.begin(), idx.offsets.begin() + sline + 1);
+    for (size_t i = 0; i + 1 < replacement.size(); i++) if (replacement[i] == '\n') offsets.push_back(from + i + 1);
+    for (size_t i = eline + 1; i < idx.offsets.size(); i++) offsets.push_back(idx.offsets[i] + delta);
+    idx.offsets = std::move(offsets);
+    idx.stamp(st);
+
+}
+
+void writefile(const std::string& path, const std::string& content, bool append) {
+    lineindices.erase(path);
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    std::ofstream out(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+    if (!out) throw oserror(path);
+    out << content;
+}
+
+bool canwrite(const std::string& module, const std::string& target, pjson dgraph) {
+    return graphcanwrite(dgraph, module, target);
+}
+
+std::vector<std::string> getmodules(const std::string& module, const std::string& target, pjson dgraph) { // resolves a module pattern for reading
+
+    auto& g = dgraph->getDict();
+
+    if (target == ".children") return strings(g["children"]->getDict()[module]);
+    if (target == ".") return { module };
+    if (target == "*") return strings(g["modules"]);
+    if (!graphhasmodule(dgraph, target)) throw std::runtime_error("Invalid module pattern `" + target + "`.");
+    return { target };
+
+}
+
+using filepaths = std::vector<std::pair<std::string, std::string>>; // (module, file)
+
+bool setupfsop(pjson args, const std::string& module, pjson dgraph, char accessty, filepaths& paths, std::vector<std::string>& problem) { // accessty: r(ead), w(rite), a(ppend), e(dit)
+
+    std::string modulearg = strip(getarg(args, "module", module));
+    std::string patharg = strip(getarg(args, "path"));
+
+    if (patharg.find('/') != std::string::npos)
+        throw std::runtime_error("Illegal path argument `" + patharg + "` contains the character `/`. Not allowed to create subdirectories inside a module.");
+
+    if (accessty == 'r') {
+        auto targets = getmodules(module, modulearg, dgraph);
+        if (targets.empty()) {
+            problem = { "No modules matched the pattern `" + modulearg + "`." };
+            return false;
+        }
+        for (const auto& target : targets)
+            for (const auto& f : graphglob(dgraph, target, patharg)) paths.push_back({ target, f });
+    }
+    else {
+        if (modulearg == ".") modulearg = module;
+        if (!graphhasmodule(dgraph, modulearg))
+            throw std::runtime_error("Module `" + modulearg + "` does not exist.");
+        if (!canwrite(module, modulearg, dgraph))
+            throw std::runtime_error("Module `" + module + "` does not have permission to write to module `" + modulearg + ".`");
+        if (accessty == 'e' && !graphhasfile(dgraph, modulearg, patharg))
+            throw std::runtime_error("Module `" + modulearg + "` does not contain file `" + patharg + "`.");
+        paths.push_back({ modulearg, patharg });
+    }
+
+    if (paths.empty()) {
+        problem = { "No files matched the pattern `" + modulearg + "/" + patharg + "`." };
+        return false;
+    }
+    return true;
+
+}
+
+long lineargument(pjson args, const std::string& name) { // python's int() on whatever the agent passed, or -1
+    auto& a = args->getDict();
+    auto it = a.find(name);
+    if (it == a.end()) return -1;
+    switch (it->second->getDtype()) {
+        case json::dtype::lint: return (long)it->second->getInt();
+        case json::dtype::ldouble: return (long)it->second->getFloat();
+        case json::dtype::lbool: return it->second->getBool() ? 1 : 0;
+        case json::dtype::lstring: {
+            std::string s = strip(it->second->getString());
+            try {
+                size_t used;
+                long v = std::stol(s, &used);
+                return used == s.size() ? v : -1;
+            }
+            catch (...) { return -1; }
+        }
+        default: return -1;
+    }
+}
+
+// implementations of the built-in actions
+
+using actionfn = std::function<std::vector<std::string>(const std::string&, pjson, const std::string&, pjson)>;
+
+std::vector<std::string> cmd_no_op(const std::string&, pjson, const std::string&, pjson) { return { "Successfully done nothing." }; }
+
+std::vector<std::string> cmd_list(const std::string&, pjson args, const std::string& module, pjson dgraph) {
+
+    std::string modulearg = strip(getarg(args, "module", module));
+    auto targets = getmodules(module, modulearg, dgraph);
+    if (targets.empty()) return { "No modules matched the pattern `" + modulearg + "`." };
+
+    std::vector<std::string> out;
+    for (const auto& target : targets) {
+        auto files = strings(dgraph->getDict()["files"]->getDict()[target]);
+        if (files.empty()) out.push_back("Module `" + target + "` is empty.");
+        else out.push_back("Contents of module `" + target + "`:\n" + joinstrings(files, "\n"));
+    }
+    return out;
+
+}
+
+std::vector<std::string> cmd_read(const std::string& proot, pjson args, const std::string& module, pjson dgraph) {
+
+    filepaths paths;
+    std::vector<std::string> problem;
+    if (!setupfsop(args, module, dgraph, 'r', paths, problem)) return problem;
+
+    std::vector<std::string> out;
+    for (const auto& p : paths) {
+        auto path = fullpath(proot, p.first, p.second);
+        out.emplace_back();
+        if (!cachedread(path, "Contents of file `" + p.first + "/" + p.second + "`:\n", out.back())) throw oserror(path);
+    }
+    return out;
+
+}
+
+std::vector<std::string> writeappend(const std::string& proot, pjson args, const std::string& module, pjson dgraph, char accessty) {
+
+    filepaths paths;
+    std::vector<std::string> problem;
+    if (!setupfsop(args, module, dgraph, accessty, paths, problem)) return problem;
+
+    std::string content = strip(getarg(args, "content"));
+
+    for (const auto& p : paths) {
+        auto path = fullpath(proot, p.first, p.second);
+        if (accessty == 'a') {
+            storeunshare(proot, p.first, p.second, true);
+            writefile(path, content, true);
+        }
+        else if (!storeput(proot, p.first, p.second, content)) { // unless the content store took it
+            storeunshare(proot, p.first, p.second, false); // the file may still be a link to the old blob
+            writefile(path, content, false);
+        }
+        searchupdate(path);
+        filecacheforget(path);
+        snapshotchanged(p.first, p.second);
+        if (!graphhasfile(dgraph, p.first, p.second)) graphaddfile(dgraph, p.first, p.second);
+    }
+
+    return { "Content successfully written to `" + paths[0].first + "/" + paths[0].second + "`." };
+
+}
+
+std::vector<std::string> cmd_write(const std::string& proot, pjson args, const std::string& module, pjson dgraph) { return writeappend(proot, args, module, dgraph, 'w'); }
+
+std::vector<std::string> cmd_append(const std::string& proot, pjson args, const std::string& module, pjson dgraph) { return writeappend(proot, args, module, dgraph, 'a'); }
+
+std::vector<std::string> cmd_read_lines(const std::string& proot, pjson args, const std::string& module, pjson dgraph) {
+
+    filepaths paths;
+    std::vector<std::string> problem;
+    if (!setupfsop(args, module, dgraph, 'r', paths, problem)) return problem;
+
+    long start = lineargument(args, "start_line");
+    long count = lineargument(args, "count");
+    bool ranged = start >= 0 || count >= 0; // without either, the whole file, as always
+    if (start < 0) start = 0;
+    if (count < 1) count = PAGE_SIZE;
+
+    std::vector<std::string> out;
+    for (const auto& p : paths) {
+
+        auto path = fullpath(proot, p.first, p.second);
+        auto& idx = linesof(path);
+        long first = ranged ? std::min(start, idx.count()) : 0;
+        long last = ranged ? std::min(first + count, idx.count()) : idx.count();
+
+        std::string name = p.first + "/" + p.second;
+        if (ranged && first >= last) {
+            out.push_back("File `" + name + "` has " + std::to_string(idx.count()) + " lines.");
+            continue;
+        }
+
+        std::string content = readlinerange(path, idx, first, last);
+        std::string s = "Contents of file `" + name + "`" + (ranged ? " (lines " + std::to_string(first) + "-" + std::to_string(last - 1) + " of " + std::to_string(idx.count()) + ")" : "") + ":\n";
+        for (long ln = first; ln < last; ln++) {
+            if (ln > first) s += "\n";
+            s += "Line " + std::to_string(ln) + ": ```";
+            s.append(content, idx.offsets[ln] - idx.offsets[first], idx.offsets[ln + 1] - idx.offsets[ln]);
+            s += "```";
+        }
+        out.push_back(s);
+
+    }
+    return out;
+
+}
+
+std::vector<std::string> cmd_edit(const std::string& proot, pjson args, const std::string& module, pjson dgraph) {
+
+    filepaths paths;
+    std::vector<std::string> problem;
+    if (!setupfsop(args, module, dgraph, 'e', paths, problem)) return problem;
+
+    std::vector<std::string> newlines;
+    auto& a = args->getDict();
+    if (a.count("new_lines")) {
+        if (a["new_lines"]->getDtype() != json::dtype::list) throw std::runtime_error("Argument `new_lines` must be a list of strings.");
+        for (const auto& l : a["new_lines"]->getList()) {
+            if (l->getDtype() != json::dtype::lstring) throw std::runtime_error("Argument `new_lines` must be a list of strings.");
+            newlines.push_back(l->getString());
+        }
+    }
+
+    long sline = lineargument(args, "start_line");
+    long eline = lineargument(args, "end_line");
+    if (eline == -1) eline = sline;
+
+    for (const auto& p : paths) {
+
+        auto path = fullpath(proot, p.first, p.second);
+        storeunshare(proot, p.first, p.second, true);
+        auto& idx = linesof(path);
+        if (sline < 0 || eline >= idx.count() || sline > eline)
+            throw std::runtime_error(
+                "Invalid line range [(" + std::to_string(sline) + ", " + std::to_string(eline) + ")] for file `" +
+                p.first + "/" + p.second + "` with " + std::to_string(idx.count()) + " lines."
+            );
+
+        splicelines(path, idx, sline, eline, joinstrings(newlines, "\n") + "\n");
+        searchupdate(path);
+        filecacheforget(path);
+        snapshotchanged(p.first, p.second);
+
+    }
+
+    return { "Successfully edited lines " + std::to_string(sline) + "-" + std::to_string(eline) + " of `" + paths[0].first + "/" + paths[0].second + "`." };
+
+}
+
+std::vector<std::string> cmd_search(const std::string& proot, pjson args, const std::string& module, pjson dgraph) {
+
+    std::string query = strip(getarg(args, "query"));
+    if (query.empty()) throw std::runtime_error("Search query is missing or empty.");
+
+    std::string modulearg = strip(getarg(args, "module", "*"));
+    std::string patharg = strip(getarg(args, "path", "*"));
+    if (patharg.empty()) patharg = "*";
+    if (patharg.find('/') != std::string::npos)
+        throw std::runtime_error("Illegal path argument `" + patharg + "` contains the character `/`. Not allowed to create subdirectories inside a module.");
+
+    long limit = lineargument(args, "limit");
+    limit = limit < 1 ? SEARCH_LIMIT : std::min(limit, MAX_SEARCH_LIMIT);
+    long context = lineargument(args, "context");
+    context = context < 0 ? SEARCH_CONTEXT : std::min(context, MAX_SEARCH_CONTEXT);
+
+    auto targets = getmodules(module, modulearg, dgraph);
+    if (targets.empty()) return { "No modules matched the pattern `" + modulearg + "`." };
+
+    filepaths files;
+    std::vector<std::string> full;
+    for (const auto& target : targets)
+        for (const auto& f : graphglob(dgraph, target, patharg)) {
+            files.push_back({ target, f });
+            full.push_back(fullpath(proot, target, f));
+        }
+
+    size_t total = 0;
+    auto hits = searchlines(full, query, limit, total);
+    if (hits.empty()) return { "No lines matched `" + query + "`." };
+
+    std::string s = "Found " + std::to_string(total) + " matching line(s) for `" + query + "`" + (total > hits.size() ? ", showing the best " + std::to_string(hits.size()) : "") + ":";
+    for (const auto& h : hits) {
+        auto& idx = linesof(full[h.first]);
+        long first = std::max(0L, h.second - context), last = std::min(idx.count(), h.second + context + 1);
+        if (first >= last) continue;
+        std::string content = readlinerange(full[h.first], idx, first, last);
+        s += "\n\n`" + files[h.first].first + "/" + files[h.first].second + "`, line " + std::to_string(h.second) + ":";
+        for (long ln = first; ln < last; ln++) {
+            s += "\nLine " + std::to_string(ln) + ": ```";
+            s.append(content, idx.offsets[ln] - idx.offsets[first], idx.offsets[ln + 1] - idx.offsets[ln]);
+            s += "```";
+        }
+    }
+    return { s };
+
+}
+
+std::vector<std::string> cmd_query_modules(const std::string&, pjson, const std::string& module, pjson dgraph) {
+
+    auto& g = dgraph->getDict();
+    auto children = strings(g["children"]->getDict()[module]);
+    auto allmodules = strings(g["modules"]);
+
+    return {
+        "Current module: `" + module + "`\nChildren of current module: `" +
+        (children.empty() ? "[none]" : joinstrings(children, "`, `")) +
+        "`\nAll modules: `" + joinstrings(allmodules, "`, `") + "`"
+    };
+
+}
+
+std::vector<std::string> cmd_create_module(const std::string&, pjson args, const std::string& module, pjson dgraph) {
+
+    std::string modulearg = strip(getarg(args, "module_name"));
+
+    if (modulearg.empty()) throw std::runtime_error("Module name missing or empty.");
+    if (graphhasmodule(dgraph, modulearg)) throw std::runtime_error("There is already a module named `" + modulearg + "`.");
+
+    graphaddmodule(dgraph, module, modulearg);
+    return { "Successfully created module `" + modulearg + "`." };
+
+}
+
+bool builtinanswer(pjson args) {
+
+    std::string answer = strip(getarg(args, "answer"));
+    for (auto& c : answer) c = std::tolower((unsigned char)c);
+
+    if (answer.empty()) throw std::runtime_error("Answer is missing or empty.");
+    if (answer == "yes") return true;
+    if (answer == "no") return false;
+    throw std::runtime_error("Answer must be either `yes` or `no`.");
+
+}
+
+const std::map<std::string, actionfn> BUILTIN_ACTIONS = {
+    { "no_op", cmd_no_op },
+    { "list", cmd_list },
+    { "read", cmd_read },
+    { "write", cmd_write },
+    { "append", cmd_append },
+    { "read_lines", cmd_read_lines },
+    { "edit", cmd_edit },
+    { "query_modules", cmd_query_modules },
+    { "search", cmd_search },
+    { "create_module", cmd_create_module }
+};
+
+std::vector<std::string> runbuiltinaction(const std::string& name, const std::string& proot, pjson args, const std::string& module, pjson dgraph) {
+
+    auto it = BUILTIN_ACTIONS.find(name);
+    if (it == BUILTIN_ACTIONS.end()) throw std::runtime_error("Unknown built-in action `" + name + "`.");
+    return it->second(proot, args, module, dgraph);
+
+}
@@ -0,0 +1,19 @@
+#ifndef _actions_inc
+#define _actions_inc
+
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+// native implementations of the built-in actions; everything else (plugins) still runs in the python server
+
+pjson builtincommands(); // name -> function declaration, for every built-in action including `answer`
+bool isbuiltinaction(const std::string& name);
+
+// runs a built-in action for `module` and returns its output messages; updates dgraph in place. throws runtime_error with
+// the message the agent gets to see if the action fails
+std::vector<std::string> runbuiltinaction(const std::string& name, const std::string& proot, pjson args, const std::string& module, pjson dgraph);
+
+bool builtinanswer(pjson args); // the `answer` pseudo-action used by branches
+
+#endif
@@ -0,0 +1,160 @@
+#include <iostream>
+#include "defs.hpp"
+#include "json.hpp"
+#include "actions.hpp"
+#include "metrics.hpp"
+
+/*
+native handling of model replies
+
+the reply body is parsed once, checked here (one candidate with content, at most one function call and at most one text
+part, and whatever the await expects) and turned into the context elements that go back to the agent. reply and branch
+turns and calls to built-in actions never leave the process; only calls to plugin actions are forwarded to the action
+server, which runs the same checks again (server.py, handle_agent).
+
+the result has the shape handle_agent has always returned: { new_context, agent_error, answer (branches), usage }. the
+error messages are part of the agent-facing API and match the server's word for word.
+*/
+
+extern pjson gencontextelement(const std::string& text, bool isuser); // api.cpp
+extern pjson runaction(const std::string& response, pjson expecting, pjson default_params, const std::string& response_type, const std::string& proot, const std::string& curmodule, pjson dgraph);
+
+pjson agentresult(pjson newctx, bool agenterror) {
+    auto r = json::makeDict();
+    r->getDict()["new_context"] = newctx;
+    r->getDict()["agent_error"] = json::makeBool(agenterror);
+    return r;
+}
+
+pjson agentmessedup(pjson content, const std::string& reason) {
+    auto newctx = json::makeList();
+    if (content) newctx->getList().push_back(content);
+    newctx->getList().push_back(gencontextelement("Error: " + reason, true));
+    metricadd("agent.bad_replies");
+    return agentresult(newctx, true);
+}
+
+pjson validatereply(pjson response, const awaitplan& plan, pjson& content, int& callidx) { // returns an error result, or nullptr if the reply is usable
+
+    bool expectingcall = plan.responsetype != "reply";
+    auto& rd = response->getDict();
+
+    auto candidates = rd.find("candidates");
+    bool bad = candidates == rd.end() || candidates->second->getDtype() != json::dtype::list || candidates->second->getList().empty();
+
+    if (!bad) {
+        auto candidate = candidates->second->getList()[0];
+        auto& cd = candidate->getDict();
+        auto c = cd.find("content");
+        if (c == cd.end() || c->second->getDtype() != json::dtype::dict) bad = true;
+        else {
+            content = c->second;
+            auto& contd = content->getDict();
+            auto parts = contd.find("parts");
+            bad = parts == contd.end() || parts->second->getDtype() != json::dtype::list || parts->second->getList().empty();
+        }
+    }
+
+    if (bad) return agentmessedup(content, "No content found in response. This is often caused by the server failing to parse a malformed function call. Make sure all double quotes in string arguments are properly escaped with a backslash.");
+
+    int textidx = -1;
+    auto& parts = content->getDict()["parts"]->getList();
+
+    for (int i = 0; i < (int)parts.size(); i++) {
+
+        if (parts[i]->getDtype() != json::dtype::dict) continue;
+        auto& pd = parts[i]->getDict();
+
+        if (pd.count("functionCall")) {
+            if (callidx >= 0) return agentmessedup(content, "Only one function may be called per response.");
+            auto& call = pd["functionCall"];
+            if (call->getDtype() != json::dtype::dict) return agentmessedup(content, "Malformed function call in reply.");
+            auto name = call->getDict().find("name");
+            if (name == call->getDict().end() || name->second->getDtype() != json::dtype::lstring)
+                return agentmessedup(content, "Function call in reply has no function name.");
+            callidx = i;
+        }
+
+        if (pd.count("text")) {
+            if (textidx >= 0) return agentmessedup(content, "Only one text object may be provided per response.");
+            textidx = i;
+        }
+
+    }
+
+    if (expectingcall && callidx < 0) return agentmessedup(content, "No function call found in reply.");
+    if (!expectingcall && textidx < 0) return agentmessedup(content, "No text content found in reply.");
+
+    return nullptr;
+
+}
+
+pjson handleagent(pjson response, const awaitplan& plan, const std::string& proot, const std::string& curmodule, pjson dgraph) {
+
+    pjson content;
+    int callidx = -1;
+
+    auto result = validatereply(response, plan, content, callidx);
+
+    if (!result) {
+
+        auto newctx = json::makeList();
+        newctx->getList().push_back(content);
+
+        if (plan.responsetype == "reply") result = agentresult(newctx, false);
+        else {
+
+            auto& call = content->getDict()["parts"]->getList()[callidx]->getDict()["functionCall"]->getDict();
+            auto name = call["name"]->getString();
+
+            bool expected = false;
+            for (const auto& e : plan.expecting->getList()) if (e->getString() == name) expected = true;
+
+            if (expected && !isbuiltinaction(name)) { // plugin; the server runs it
+                auto resp = runaction(response->dump(), plan.expecting, plan.defaultparams, plan.responsetype, proot, curmodule, dgraph);
+                result = resp->getDict()["data"];
+            }
+            else {
+
+                auto args = json::makeDict();
+                auto callargs = call.find("args");
+                if (callargs != call.end() && callargs->second->getDtype() == json::dtype::dict) args->getDict() = callargs->second->getDict();
+                auto defaults = plan.defaultparams->getDict().find(name);
+                if (defaults != plan.defaultparams->getDict().end()) // arguments fixed by the dialogue win over the agent's
+                    for (const auto& kv : defaults->second->getDict()) args->getDict()[kv.first] = kv.second;
+
+                bool ans = false, ok = true;
+
+                try {
+
+                    if (!expected) {
+                        std::string names;
+                        auto& l = plan.expecting->getList();
+                        for (size_t i = 0; i < l.size(); i++) names += (i > 0 ? "`, `" : "") + l[i]->getString();
+                        throw std::runtime_error("Agent was suppposed to call one of the following functions: `" + names + "` in this reply, but instead attempted to call `" + name + "`.");
+                    }
+
+                    if (name == "answer") ans = builtinanswer(args);
+                    else for (const auto& text : runbuiltinaction(name, proot, args, curmodule, dgraph)) newctx->getList().push_back(gencontextelement(text, true));
+
+                }
+                catch (const std::exception& e) {
+                    newctx->getList().push_back(gencontextelement(std::string("Error: ") + e.what(), true));
+                    ok = false;
+                }
+
+                result = agentresult(newctx, !ok);
+                if (plan.responsetype == "branch") result->getDict()["answer"] = json::makeBool(ans);
+
+            }
+
+        }
+
+    }
+
+    auto usage = response->getDict().find("usageMetadata"); // token accounting for the context budget manager
+    if (usage != response->getDict().end()) result->getDict()["usage"] = usage->second;
+
+    return result;
+
+}
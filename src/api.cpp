@@ -9,11 +9,13 @@
 #include <curl/curl.h>
 #include "defs.hpp"
 #include "json.hpp"
-#include "commands.hpp"
 #include "server.hpp"
+#include "metrics.hpp"
+#include "retry.hpp"
 
-const std::string URL = "https://generativelanguage.googleapis.com/v1beta/models/gemini-2.5-flash:generateContent";
-const int MAX_API_BACKOFF_TIME = 64;
+extern const std::string API_ROOT = "https://generativelanguage.googleapis.com/v1beta/";
+extern const std::string MODEL = "models/gemini-2.5-flash";
+const std::string URL = API_ROOT + MODEL + ":generateContent";
 const int MAX_REPLY_ATTEMPTS = 6;
 
 class CurlClient { // chatgpt
@@ -24,17 +26,23 @@ public:
     }
 
     CURL* getHandle() const { return curl; }
+    CURL* getHedgeHandle() const { return hedge; }
+    CURLM* getMulti() const { return multi; } // hedged requests run both handles here; it keeps its own connection pool
     struct curl_slist* getHeaders() const { return headers; }
 
 private:
     CURL* curl = nullptr;
+    CURL* hedge = nullptr;
+    CURLM* multi = nullptr;
     struct curl_slist* headers = nullptr;
 
     CurlClient() {
         curl_global_init(CURL_GLOBAL_ALL);
         curl = curl_easy_init();
+        hedge = curl_easy_init();
+        multi = curl_multi_init();
 
-        if (!curl) {
+        if (!curl || !hedge || !multi) {
             throw std::runtime_error("Failed to initialize libcurl handle");
         }
 
@@ -51,6 +59,8 @@ private:
 
     ~CurlClient() {
         if (curl) curl_easy_cleanup(curl);
+        if (hedge) curl_easy_cleanup(hedge);
+        if (multi) curl_multi_cleanup(multi);
         if (headers) curl_slist_free_all(headers);
         curl_global_cleanup();
     }
@@ -65,17 +75,33 @@ static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* use
     return totalSize;
 }
 
+static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userp) { // picks out Retry-After for the retry policy
+    size_t totalSize = size * nitems;
+    std::string header(buffer, totalSize);
+    const std::string name = "retry-after:";
+    if (header.size() > name.size()) {
+        std::string lower = header.substr(0, name.size());
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if (lower == name) {
+            std::string value = header.substr(name.size());
+            auto* reply = static_cast<httpreply*>(userp);
+            try { reply->retryafter = std::stod(value); }
+            catch (...) { // HTTP-date form
+                time_t when = curl_getdate(value.c_str(), nullptr);
+                if (when > 0) reply->retryafter = std::max<double>(0, (double)(when - time(nullptr)));
+            }
+        }
+    }
+    return totalSize;
+}
 
-long curl_post_request(const std::string& payload, std::string& response_body) { // chatgpt
+static void setup_post(CURL* curl, const std::string& url, const std::string& payload, std::string& response_body, httpreply* reply) {
     CurlClient& client = CurlClient::getInstance();
-    CURL* curl = client.getHandle();
-
-    if (!curl) return -1;
 
     response_body.clear();
     curl_easy_reset(curl);  // Important: Reset between uses
 
-    curl_easy_setopt(curl, CURLOPT_URL, URL.c_str()); // <-- fix is here
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, client.getHeaders());
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload.c_str());
     curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, payload.size());
@@ -84,18 +110,110 @@ long curl_post_request(const std::string& payload, std::string& response_body) {
 
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_body);
 
+    if (reply) {
+        *reply = httpreply();
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, reply);
+    }
+}
+
+long curl_post_request(const std::string& url, const std::string& payload, std::string& response_body, httpreply* reply = nullptr) { // chatgpt
+    CURL* curl = CurlClient::getInstance().getHandle();
+
+    if (!curl) return -1;
+
+    setup_post(curl, url, payload, response_body, reply);
+
     CURLcode res = curl_easy_perform(curl);
     if (res != CURLE_OK) {
         std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
+        if (reply) { reply->code = -1; reply->curlerr = res; }
         return -1;
     }
 
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (reply) reply->code = http_code;
     
     return http_code;
 }
 
+long curl_post_request(const std::string& payload, std::string& response_body, httpreply* reply = nullptr) { return curl_post_request(URL, payload, response_body, reply); }
+
+extern double hedgedelay(const std::string& agent); // hedge.cpp
+extern bool hedgespend(const std::string& agent);
+extern void hedgeoutcome(const std::string& agent, bool hedgewon);
+extern bool ratelimittryacquire(bool interactive, size_t esttokens); // ratelimit.cpp
+
+bool wellformedreply(const std::string& body) { // cheap check so the winning body is only parsed once, in apirequest
+    return body.find("\"candidates\"") != std::string::npos;
+}
+
+long curl_post_hedged(const std::string& payload, std::string& response_body, httpreply& reply, const std::string& agent, bool interactive, size_t esttokens) { // posts to URL, duplicating the request if it is slow (see hedge.cpp)
+
+    double delay = hedgedelay(agent);
+    if (delay < 0) return curl_post_request(payload, response_body, &reply);
+
+    CurlClient& client = CurlClient::getInstance();
+    CURLM* multi = client.getMulti();
+    CURL* handles[2] = { client.getHandle(), client.getHedgeHandle() };
+    std::string bodies[2];
+    httpreply replies[2];
+
+    setup_post(handles[0], URL, payload, bodies[0], &replies[0]);
+    curl_multi_add_handle(multi, handles[0]);
+
+    auto start = std::chrono::steady_clock::now();
+    int launched = 1, finished = 0, winner = -1, last = 0;
+    bool hedged = false;
+
+    while (winner < 0 && finished < launched) {
+
+        int running;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg* msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            int i = (msg->easy_handle == handles[0]) ? 0 : 1;
+            finished++;
+            last = i;
+            if (msg->data.result != CURLE_OK) {
+                std::cerr << "curl_multi_perform() failed: " << curl_easy_strerror(msg->data.result) << std::endl;
+                replies[i].code = -1;
+                replies[i].curlerr = msg->data.result;
+            }
+            else curl_easy_getinfo(handles[i], CURLINFO_RESPONSE_CODE, &replies[i].code);
+            if (winner < 0 && replies[i].code == 200 && wellformedreply(bodies[i])) winner = i;
+        }
+        if (winner >= 0 || finished == launched) break;
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!hedged && elapsed >= delay) {
+            hedged = true;
+            if (hedgespend(agent) && ratelimittryacquire(interactive, esttokens)) {
+                setup_post(handles[1], URL, payload, bodies[1], &replies[1]);
+                curl_multi_add_handle(multi, handles[1]);
+                launched++;
+            }
+        }
+
+        int timeoutms = hedged ? 1000 : std::max(1, (int)((delay - elapsed) * 1000));
+        curl_multi_poll(multi, nullptr, 0, timeoutms, nullptr);
+
+    }
+
+    for (int i = 0; i < launched; i++) curl_multi_remove_handle(multi, handles[i]); // cancels the loser if it is still in flight
+    if (launched > 1) hedgeoutcome(agent, winner == 1);
+
+    int i = (winner >= 0) ? winner : last;
+    response_body = std::move(bodies[i]);
+    reply = replies[i];
+    return reply.code;
+
+}
+
 pjson gencontextelement(const std::string& text, bool isuser = true) {
 
     auto tmp = json::makeString(text);
@@ -117,95 +235,169 @@ pjson gencontextelement(const std::string& text, bool isuser = true) {
 
 extern std::string expand_user_path(const std::string& path); // json.cpp
 
-pjson gendefaultcontext(const std::string& module) {
+const std::string& systemprompt() { // read once per process; every context and request shares the same interned copy
+
+    static std::string prompt;
+    static bool loaded = false;
 
-    std::string prompt;
-    std::ifstream promptfile(expand_user_path(hll_projects_folder "hll_initial_prompt.txt"));
-    if (promptfile) {
-        std::ostringstream ss;
-        ss << promptfile.rdbuf();
-        prompt = ss.str();
+    if (!loaded) {
+        std::ifstream promptfile(expand_user_path(hll_projects_folder "hll_initial_prompt.txt"));
+        if (promptfile) {
+            std::ostringstream ss;
+            ss << promptfile.rdbuf();
+            prompt = ss.str();
+        }
+        loaded = true;
     }
 
+    return prompt;
+
+}
+
+const std::string& systeminstruction() { // pre-serialized systemInstruction field, sent as a separate channel instead of as the first user turn
+
+    static std::string si;
+
+    if (si.empty()) {
+        auto part = json::makeDict();
+        part->getDict()["text"] = json::makeString(systemprompt());
+        auto parts = json::makeList();
+        parts->getList().push_back(part);
+        auto elem = json::makeDict();
+        elem->getDict()["parts"] = parts;
+        si = elem->dump();
+    }
+
+    return si;
+
+}
+
+pjson gendefaultcontext(const std::string& module) {
+
     auto ctx = json::makeList();
-    ctx->getList().push_back(gencontextelement(prompt + "\nYou are currently residing in a module named `" + module + "`.", true));
+    ctx->getList().push_back(gencontextelement("You are currently residing in a module named `" + module + "`.", true));
     ctx->getList().push_back(gencontextelement("Understood.", false)); // injecting agent reply into the context -- user gives instructions and agent replies "Understood."
 
     return ctx;
 
 }
 
-pjson genconfig;
+void stripsystemprompt(pjson ctx) { // contexts saved by older runtimes carry the system prompt inline as their first turn; it now travels as the system instruction instead
 
-bool argexists(std::map<std::string, pjson>& args, const std::string& arg) { return args.find(arg) != args.end(); }
+    const auto& prompt = systemprompt();
+    auto& l = ctx->getList();
+    if (prompt.empty() || l.empty()) return;
 
-bool moduleexists(const std::string& modname, pjson dgraph) {
-    auto& l = dgraph->getDict()["modules"]->getList();
-    for (auto m : l) if (m->getString() == modname) return true;
-    return false;
-}
+    auto& parts = l[0]->getDict()["parts"]->getList();
+    if (parts.empty() || !parts[0]->getDict().count("text")) return;
 
-bool ischild(const std::string& parent, const std::string& child, pjson dgraph) {
-    auto& l = dgraph->getDict()["children"]->getDict()[parent]->getList();
-    for (auto m : l) if (m->getString() == child) return true;
-    return false;
-}
+    auto text = parts[0]->getDict()["text"]->getString();
+    if (text.compare(0, prompt.size(), prompt) != 0) return;
 
-bool isdependency(const std::string& dependent, const std::string& dependency, pjson dgraph) {
-    auto& l = dgraph->getDict()["dependencies"]->getDict()[dependent]->getList();
-    for (auto m : l) if (m->getString() == dependency) return true;
-    return false;
-}
+    text = text.substr(prompt.size());
+    if (!text.empty() && text[0] == '\n') text = text.substr(1);
+    parts[0]->getDict()["text"] = json::makeString(text);
 
-bool fileexists(const std::string& modname, const std::string& filename, pjson dgraph) {
-    auto& l = dgraph->getDict()["files"]->getDict()[modname]->getList();
-    for (auto m : l) if (m->getString() == filename) return true;
-    return false;
 }
 
-extern pjson ALL_COMMANDS;
-extern pjson ALL_LEGAL_COMMANDS;
-void loadcommands();
+extern size_t prefixcache(const std::vector<std::string>& elems, const std::string& si, const std::string& tools, std::string& handle); // prefixcache.cpp
+extern void dropprefixcaches();
 
-pjson ALL_LEGAL_COMMANDS_V;
+std::string genrequestbody(pjson ctx, const std::string& tools, bool& usedcache, bool allowcache = true) { // assembled from pre-serialized pieces; all keys are in sorted order so identical prefixes are byte-identical across requests
 
-void gencmdstr(std::string& s, pjson expecting) {
+    static std::string genconfigbytes = json::loadFromString("{\"thinkingConfig\":{\"include_thoughts\": false, \"thinkingBudget\": 0}}")->dump();
 
-    auto& l = expecting->getList();
+    std::vector<std::string> elems;
+    elems.reserve(ctx->getList().size());
+    for (const auto& e : ctx->getList()) elems.push_back(e->dump());
 
-    for (int i = 0; i < l.size(); i++) {
-        
-        auto cmd = l[i];
-        s += "`" + cmd->getString() + "`";
-        if (i < l.size() - 1) s += ", ";
+    std::string handle;
+    size_t cached = allowcache ? prefixcache(elems, systeminstruction(), tools, handle) : 0;
+    usedcache = cached > 0;
 
+    std::string body = "{";
+    if (usedcache) body += "\"cachedContent\":" + json::makeString(handle)->dump() + ",";
+
+    body += "\"contents\":[";
+    for (size_t i = cached; i < elems.size(); i++) {
+        if (i > cached) body += ",";
+        body += elems[i];
+    }
+    body += "],\"generationConfig\":" + genconfigbytes;
+
+    if (!usedcache) { // a cached prefix already carries the system instruction and tools, and the API refuses them twice
+        body += ",\"systemInstruction\":" + systeminstruction();
+        if (!tools.empty()) body += ",\"tools\":" + tools;
     }
 
+    return body + "}";
+
 }
 
-pjson getexpecting(const std::vector<actiondata>& actions) {
+std::string apierrormessage(const std::string& body) { // {"error": {"message": "..."}}
+    try { return json::loadFromString(body)->getDict()["error"]->getDict()["message"]->getString(); }
+    catch (...) { return ""; }
+}
 
-    if (!ALL_LEGAL_COMMANDS) {
-        loadcommands();
-        ALL_LEGAL_COMMANDS_V = json::makeList();
-        for (const auto& cmd : ALL_LEGAL_COMMANDS->getDict()) ALL_LEGAL_COMMANDS_V->getList().push_back(json::makeString(cmd.first));
-    }
+extern size_t bytestotokens(size_t bytes); // context.cpp
+extern void ratelimitacquire(bool interactive, size_t esttokens); // ratelimit.cpp
+extern void hedgerecord(double seconds); // hedge.cpp
 
-    pjson expecting;
-    
-    if (actions.size() == 0) expecting = ALL_LEGAL_COMMANDS_V;
+std::string postwithretry(pjson ctx, const std::string& tools, const std::string& agent, bool interactive, size_t& esttokens) { // sends one generateContent request under the process-wide retry policy and the shared rate limits; throws once the policy gives up
 
-    else {
-    
-        expecting = json::makeList();
-        for (const auto& a : actions) expecting->getList().push_back(json::makeString(a.aname));
+    auto& policy = apiretrypolicy();
+    bool usedcache;
+    auto requestbody = genrequestbody(ctx, tools, usedcache);
+    std::string response;
+    httpreply reply;
 
-    }
+    for (int attempt = 0;; attempt++) {
+
+        policy.waitforbreaker();
+        esttokens = bytestotokens(requestbody.size());
+        ratelimitacquire(interactive, esttokens);
+        auto start = std::chrono::steady_clock::now();
+        curl_post_hedged(requestbody, response, reply, agent, interactive, esttokens);
+        if (reply.code == 200) {
+            hedgerecord(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            policy.onsuccess();
+            return response;
+        }
 
-    return expecting;
+        if (usedcache) { // the cached prefix may have expired early on the provider side, which comes back as a 4xx the policy
+            // would give up on; resend everything inline once, without counting it against the breaker or the retry budget
+            dropprefixcaches();
+            requestbody = genrequestbody(ctx, tools, usedcache, false);
+            attempt--;
+            continue;
+        }
+
+        reply.body = response;
+        std::string giveup;
+        double delay = policy.onfailure(reply, attempt, giveup);
+        std::string reason = reply.code < 0 ? "Network error" : "Status code " + std::to_string(reply.code);
+        auto message = apierrormessage(response);
+        if (!message.empty()) reason += " (" + message + ")";
+
+        if (delay < 0)
+            throw std::runtime_error(
+                "Failed to get API reply: " + reason + "; " + giveup + ".\n" +
+                "Did you forget to set the GEMINI_API_KEY environment variable? Use `resume` to continue once the problem is fixed."
+            );
+
+        std::cerr << "Failed to get API reply: " << reason << ". "
+                << "Trying again in " << (int)(delay + 0.5) << " seconds." << std::endl;
+        policy.clock.sleep(delay);
+
+    }
 
 }
 
+bool argexists(std::map<std::string, pjson>& args, const std::string& arg) { return args.find(arg) != args.end(); }
+
+extern pjson postwithgraph(pjson req, pjson dgraph); // graph.cpp
+extern std::string pluginschemahash; // plugins.cpp
+
 pjson runaction(const std::string& response, pjson expecting, pjson default_params, const std::string& response_type, const std::string& proot, const std::string& curmodule, pjson dgraph) {
 
     auto data = json::makeDict();
@@ -217,13 +409,13 @@ pjson runaction(const std::string& response, pjson expecting, pjson default_para
     dd["response_type"] = json::makeString(response_type);
     dd["project_root"] = json::makeString(proot);
     dd["module"] = json::makeString(curmodule);
-    dd["dependency_graph"] = dgraph;
+    if (!pluginschemahash.empty()) dd["schema_hash"] = json::makeString(pluginschemahash);
 
     auto req = json::makeDict();
     req->getDict()["request"] = json::makeString("handle_agent");
     req->getDict()["data"] = data;
 
-    auto resp = json::loadFromString(post(req->print()));
+    auto resp = postwithgraph(req, dgraph);
     auto& rd = resp->getDict();
 
     if (rd["status"]->getString() == "err")
@@ -233,89 +425,43 @@ pjson runaction(const std::string& response, pjson expecting, pjson default_para
 
 }
 
-bool apirequest(const std::string& proot, const std::string& curmodule, pjson& dgraph, pjson ctx, ptok k, const std::vector<actiondata>& actions) {
-    
-    if (!genconfig) genconfig = json::loadFromString("{\"thinkingConfig\":{\"include_thoughts\": false, \"thinkingBudget\": 0}}");
-    
-    bool needscall = k != reply;
-    auto expecting = needscall ? getexpecting(actions) : json::makeList();
-    
-    pjson tools = json::loadFromString("[{ \"function_declarations\": [] }]");
-    auto default_params = json::makeDict();
-
-    if (needscall) {
-
-        auto& funcdeclars = tools->getList()[0]->getDict()["function_declarations"]->getList();
-
-        for (const auto& a : actions) {
+extern size_t contextbudget(const std::string& agent); // context.cpp
+extern size_t contextbytes(const pjson& ctx);
+extern void compactcontext(pjson ctx, size_t budget);
+extern void recordusage(const pjson& usage, size_t ctxbytes);
+extern void ratelimitsettle(size_t esttokens, size_t actualtokens); // ratelimit.cpp
+extern pjson handleagent(pjson response, const awaitplan& plan, const std::string& proot, const std::string& curmodule, pjson dgraph); // agent.cpp
 
-            auto candidates = json::loadFromString(ALL_COMMANDS->getDict()[a.aname]->print()); // sloppy deep-copy method; fix this later
+bool apirequest(const std::string& proot, const std::string& curmodule, const std::string& agent, bool interactive, pjson& dgraph, pjson ctx, const inst_await& in) {
 
-            for (const auto& arg : a.args->getDict()) {
+    const auto& plan = in.plan;
 
-                candidates->getDict()["parameters"]->getDict()["properties"]->getDict().erase(arg.first);
-
-                auto& required_args = candidates->getDict()["parameters"]->getDict()["required"]->getList();
-                for (auto rarg = required_args.begin(); rarg != required_args.end(); rarg++)
-                    if ((*rarg)->getString() == arg.first) {
-                        required_args.erase(rarg);
-                        break;
-                    }
-
-            }
-
-            funcdeclars.push_back(candidates);
-            default_params->getDict()[a.aname] = a.args;
-
-        }
-
-    }
-
-    std::string instructionctx;
-    if (needscall) {
-        instructionctx = "In your next reply, you are **required** to call one of the following functions: ";
-        gencmdstr(instructionctx, expecting);
-        instructionctx += " using the Gemini function calling API.\nIMPORTANT: The values of string arguments should escape all internal back-slashes (`\\`) and quotes (`\"`). Otherwise, your reply will not be parsed correctly.";
-        /*if (default_params->getDict().size() > 0) {
-            instructionctx += "\nThe following parameters have already been supplied, and you should not provide them yourself:\n";
-            for (const auto& kv : default_params) {
-                if (kv.second->getDict().size() == 0) continue;
-                std::cout << 
-            }
-        }*/
-    }
-    else instructionctx = "Please answer in plaintext, without calling any functions.";
+    stripsystemprompt(ctx);
+    compactcontext(ctx, contextbudget(agent));
 
     auto ctxlen = ctx->getList().size();
-    ctx->getList().push_back(gencontextelement(instructionctx));
+    ctx->getList().push_back(gencontextelement(plan.instruction, true));
 
     for (int attempt = 0;; attempt++) {
         
-        int backoff_time = 1;
-        std::string response;
-        long http_code;
+        size_t esttokens;
+        auto response = postwithretry(ctx, plan.tools, agent, interactive, esttokens);
 
-        auto requestbody = json::makeDict();
-        requestbody->getDict()["contents"] = ctx;
-        requestbody->getDict()["generationConfig"] = genconfig;
-        if (needscall) requestbody->getDict()["tools"] = tools;
-        //std::cout << "requestbody=\n" << requestbody->print() << "\n";
-        while ((http_code = curl_post_request(requestbody->print(), response)) != 200) {
+        metricadd("api.requests");
+        auto ctxbytes = contextbytes(ctx);
 
-            std::cerr << "Failed to get API reply: Status code " << http_code << ". "
-                    << "Trying again in " << backoff_time << " seconds.\n"
-                    << "Did you forget to set the GEMINI_API_KEY environment variable?" << std::endl;
+        pjson parsed;
+        try { parsed = json::loadFromString(response); }
+        catch (const std::exception& e) { throw std::runtime_error(std::string("Malformed response from model API: ") + e.what()); }
 
-            std::this_thread::sleep_for(std::chrono::seconds(backoff_time));
-            backoff_time *= 2;
-            if (backoff_time > MAX_API_BACKOFF_TIME) backoff_time = MAX_API_BACKOFF_TIME;
+        auto result = handleagent(parsed, plan, proot, curmodule, dgraph);
+        auto& respdata = result->getDict();
 
+        if (respdata.find("usage") != respdata.end()) {
+            recordusage(respdata["usage"], ctxbytes);
+            auto& u = respdata["usage"]->getDict();
+            if (u.count("totalTokenCount")) ratelimitsettle(esttokens, (size_t)u["totalTokenCount"]->getInt());
         }
-
-        auto resp = runaction(response, expecting, default_params, needscall ? (k == action ? "action" : "branch") : "reply", proot, curmodule, dgraph);
-        auto& rd = resp->getDict();
-
-        auto& respdata = rd["data"]->getDict();
         auto& newctx = respdata["new_context"]->getList();
         auto aerr = respdata["agent_error"]->getBool();
         auto ans = (respdata.find("answer") == respdata.end()) ? true : respdata["answer"]->getBool();
@@ -340,16 +486,12 @@ bool apirequest(const std::string& proot, const std::string& curmodule, pjson& d
         else {
 
             while (ctx->getList().size() > ctxlen) ctx->getList().pop_back(); // trim failed attempts and error messages from context, leaving only the well-formed answer
-
-            if (respdata.find("dependency_graph") != respdata.end())
-                dgraph = respdata["dependency_graph"];
-            //if (respdata.find("dependency_graph") != respdata.end()) std::cout << "New dgraph: \n" << dgraph->print() << "\n"; else std::cout << "No new dgraph\n";
         }
 
         for (auto c : newctx) ctx->getList().push_back(c);
         if (!aerr) return ans;
         else if (userinfo.size() > 0) ctx->getList().push_back(gencontextelement(userinfo)); // fallback: user needs to talk to agent and figure out why it's giving bad outputs
-        //if (aerr) std::cout << "request body = " << requestbody->print() << "\nctx = \n" << ctx->print() << "\n\n";
+        //if (aerr) std::cout << "request body = " << requestbody << "\nctx = \n" << ctx->print() << "\n\n";
     }
 
     return true;
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "defs.hpp"
+#include "json.hpp"
+#include "server.hpp"
+#include "actions.hpp"
+
+/*
+per-action latency of the built-in actions, native (actions.cpp) versus through the python server (server/fsop.py)
+
+usage: hll_bench_actions [iterations]
+
+runs every action `iterations` times (default 200) against a scratch project in /tmp. the server side includes the IPC
+round trip, which is exactly what the native path saves.
+*/
+
+extern pjson postwithgraph(pjson req, pjson dgraph); // graph.cpp
+
+void handle_sigint(int) {
+    std::cout << std::endl;
+    std::exit(0);
+}
+
+pjson benchgraph() {
+    return json::loadFromString(R"({
+        "children": { "global": [], "root": ["child"], "child": [] },
+        "dependencies": { "global": [], "root": [] },
+        "files": { "global": [], "root": ["a.txt", "notes.md"], "child": ["c.txt"] },
+        "id": "hll_bench_actions",
+        "modules": ["global", "root", "child"],
+        "version": 0
+    })");
+}
+
+int main(int argc, char** argv) {
+
+    int n = argc > 1 ? std::max(1, std::atoi(argv[1])) : 200;
+    std::signal(SIGINT, handle_sigint);
+
+    char dirtemplate[] = "/tmp/hll_bench_actions_XXXXXX";
+    if (!::mkdtemp(dirtemplate)) {
+        std::cerr << "Error: failed to create scratch directory\n";
+        return 1;
+    }
+    std::string proot = std::string(dirtemplate) + "/";
+    std::filesystem::create_directories(proot + "root");
+    std::filesystem::create_directories(proot + "child");
+    {
+        std::ofstream a(proot + "root/a.txt");
+        for (int i = 0; i < 200; i++) a << "line " << i << " of a moderately sized text file\n";
+        std::ofstream(proot + "root/notes.md") << "# notes\n";
+        std::ofstream(proot + "child/c.txt") << "child file\n";
+    }
+
+    const std::vector<std::pair<std::string, std::string>> cases = { // action, arguments
+        { "list", R"({"module": "*"})" },
+        { "read", R"({"module": "root", "path": "*.txt"})" },
+        { "read_lines", R"({"module": "root", "path": "a.txt"})" },
+        { "query_modules", R"({})" },
+        { "search", R"({"query": "moderately sized line 42"})" },
+        { "write", R"({"module": "child", "path": "out.txt", "content": "hello"})" },
+        { "append", R"({"module": ".", "path": "log.txt", "content": "entry"})" },
+        { "edit", R"({"module": "root", "path": "a.txt", "new_lines": ["edited"], "start_line": 3, "end_line": 3})" },
+        { "no_op", R"({})" }
+    };
+
+    auto nativegraph = benchgraph();
+    auto servergraph = benchgraph();
+    servergraph->getDict()["id"] = json::makeString(proot); // the server keeps graphs by id; don't collide with earlier runs
+
+    std::cout << std::left << std::setw(16) << "action" << std::right << std::setw(14) << "native us/op" << std::setw(14) << "server us/op" << std::setw(10) << "speedup" << "\n";
+
+    try {
+
+        for (const auto& c : cases) {
+
+            auto args = json::loadFromString(c.second);
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++) runbuiltinaction(c.first, proot, args, "root", nativegraph);
+            double native = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / n;
+
+            auto action = json::makeDict();
+            action->getDict()["name"] = json::makeString(c.first);
+            action->getDict()["args"] = args;
+            auto req = json::makeDict();
+            auto& data = req->getDict()["data"] = json::makeDict();
+            req->getDict()["request"] = json::makeString("run_user_action");
+            data->getDict()["project_root"] = json::makeString(proot);
+            data->getDict()["module"] = json::makeString("root");
+            data->getDict()["actions"] = json::makeList();
+            data->getDict()["actions"]->getList().push_back(action);
+
+            postwithgraph(req, servergraph); // warmup; syncs the graph and starts the server if necessary
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++) {
+                auto resp = postwithgraph(req, servergraph);
+                if (resp->getDict()["status"]->getString() != "ok") throw std::runtime_error(resp->getDict()["reason"]->getString());
+            }
+            double server = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / n;
+
+            std::cout << std::left << std::setw(16) << c.first << std::right << std::fixed << std::setprecision(1)
+                << std::setw(14) << native << std::setw(14) << server << std::setw(9) << server / native << "x\n";
+
+        }
+
+    }
+    catch (const std::exception& e) {
+
+        std::cout << "Error: " << e.what() << "\n";
+        std::filesystem::remove_all(proot);
+        return 1;
+
+    }
+
+    std::filesystem::remove_all(proot);
+    return 0;
+
+}
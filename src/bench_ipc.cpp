@@ -0,0 +1,86 @@
+#include <iostream>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "server.hpp"
+
+/*
+microbenchmark of the round trip to the action server
+
+usage: hll_bench_ipc [requests] [--fresh] [--pipeline depth] [--payload bytes] [--kill]
+
+sends `requests` ping requests (default 2000) and reports the mean latency and the latency histogram. with --fresh,
+the connection is dropped before every request, which measures the old connect-per-request behavior. with --pipeline,
+requests are sent in batches of `depth` before any response is read (the histogram only covers unpipelined requests).
+with --payload, every ping carries that many bytes, which the server echoes back; payloads of at least HLL_IPC_SHM_BYTES
+go through shared memory (set it to 0 to compare with the socket).
+*/
+
+void handle_sigint(int) {
+    std::cout << std::endl;
+    std::exit(0);
+}
+
+int main(int argc, char** argv) {
+
+    int n = 2000;
+    bool fresh = false;
+    int depth = 1;
+    size_t payload = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--kill") {
+            kill_server();
+            return 0;
+        }
+        else if (arg == "--fresh") fresh = true;
+        else if (arg == "--pipeline" && i + 1 < argc) depth = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--payload" && i + 1 < argc) payload = std::strtoul(argv[++i], nullptr, 10);
+        else n = std::atoi(arg.c_str());
+    }
+
+    std::signal(SIGINT, handle_sigint);
+
+    const std::string ping = payload == 0 ? R"({"data":{},"request":"ping"})" : R"({"data":{"pad":")" + std::string(payload, 'x') + R"("},"request":"ping"})";
+
+    try {
+
+        post(ping); // warmup; starts the server if necessary
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i += depth) {
+            if (fresh) disconnect();
+            if (depth == 1) {
+                post(ping);
+                continue;
+            }
+            std::vector<uint32_t> ids;
+            for (int j = i; j < std::min(n, i + depth); j++) ids.push_back(post_async(ping));
+            for (auto id : ids) wait_reply(id);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        auto total_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        std::cout << "Requests: " << n << (fresh ? " (new connection per request)" : " (persistent connection)");
+        if (depth > 1) std::cout << ", pipelined " << depth << " deep";
+        if (payload > 0) std::cout << ", " << payload << " byte payload";
+        std::cout << "\n";
+        std::cout << "Avg us/req: " << (double)total_us / n << "\n";
+        std::cout << "p50 <= " << ipc_latencies().percentile(50) << " us, p99 <= " << ipc_latencies().percentile(99) << " us\n";
+        ipc_latencies().print(std::cout);
+
+    }
+    catch (const std::exception& e) {
+
+        std::cout << "Error: " << e.what() << "\n";
+        return 1;
+
+    }
+
+    return 0;
+
+}
@@ -1,171 +1,254 @@
 #ifndef _commands_inc
 #define _commands_inc
 
-const char* LIST_COMMAND = R"RAW(
-[{
-  "function_declarations": [
-    {
-      "name": "LIST",
-      "description": "List files",
-      "parameters": {
-        "type": "object",
-        "properties": {
-            "module": {
-                "type": "string",
-                "description": "Module to list the files in; defaults to current module if left blank"
-            }
-        },
-        "required": []
-      }
-    }
-  ]
-}]
-)RAW";
-
-const char* READ_COMMAND = R"RAW(
-[{
-  "function_declarations": [
-    {
-      "name": "READ",
-      "description": "Read file",
-      "parameters": {
-        "type": "object",
-        "properties": {
-          "module": {
-            "type": "string",
-            "description": "Module that the file resides in; defaults to current module if left blank"
-          },
-          "path": {
-            "type": "string",
-            "description": "Name of the file to read"
-          }
-        },
-        "required": ["path"]
-      }
-    }
-  ]
-}]
-)RAW";
-
-const char* WRITE_COMMAND = R"RAW(
-[{
-  "function_declarations": [
-    {
-      "name": "WRITE",
-      "description": "Write file",
-      "parameters": {
-        "type": "object",
-        "properties": {
-          "module": {
-            "type": "string",
-            "description": "Module that the file to write resides in; defaults to the current module if left blank" 
-          },
-          "path": {
-            "type": "string",
-            "description": "Name of the file to write"
-          },
-          "content": {
-            "type": "string",
-            "description": "Content to write to the file"
-          }
-        },
-        "required": ["path", "content"]
-      }
-    }
-  ]
-}]
-)RAW";
-
-const char* APPEND_COMMAND = R"RAW(
-[{
-  "function_declarations": [
-    {
-      "name": "APPEND",
-      "description": "Append to file",
-      "parameters": {
-        "type": "object",
-        "properties": {
-          "module": {
-            "type": "string",
-            "description": "Module that the file to append to resides in; defaults to the current module if left blank" 
-          },
-          "path": {
-            "type": "string",
-            "description": "Name of the file to append to"
-          },
-          "content": {
-            "type": "string",
-            "description": "Content to append to the file"
-          }
-        },
-        "required": ["path", "content"]
-      }
-    }
-  ]
-}]
-)RAW";
-
-const char* LIST_MODULES_COMMAND = R"RAW(
-[{
-  "function_declarations": [
-    {
-      "name": "LIST_MODULES",
-      "description": "List all existing modules, filtered into three subcategories: (1) children of the current module, (2) dependencies of the current module, (3) all other modules",
-      "parameters": {
-        "type": "object",
-        "properties": {},
-        "required": []
-      }
-    }
-  ]
-}]
-)RAW";
-
-const char* CREATE_MODULE_COMMAND = R"RAW(
-[{
-  "function_declarations": [
-    {
-      "name": "CREATE_MODULE",
-      "description": "Create a new module and explicitly declare its dependencies",
-      "parameters": {
-        "type": "object",
-        "properties": {
-          "dependencies": {
-            "type": "array",
-            "items": {"type": "string"},
-            "description": "Dependencies may ONLY include (1) the current module, or (2) any dependencies of the current module; allowed to be an empty array"
-          },
-          "module_name": {
-            "type": "string",
-            "description": "Must not clash with any existing module names"
-          }
-        },
-        "required": ["module_name", "dependencies"]
-      }
-    }
-  ]
-}]
-)RAW";
+// function declarations of the built-in actions, in the format the model API expects (see actions.cpp); must stay in sync
+// with DEFAULT_COMMANDS in server/fsop.py
 
-const char* ANSWER_COMMAND = R"RAW(
-[{
-  "function_declarations": [
-    {
-      "name": "ANSWER",
-      "description": "Answer either YES or NO",
-      "parameters": {
-        "type": "object",
-        "properties": {
-          "answer": {
-            "type": "string",
-            "enum": ["YES", "NO"]
-          }
-        },
-        "required": ["answer"]
-      }
+const char* BUILTIN_COMMANDS = R"RAW(
+{
+    "no_op": {
+        "name": "no_op",
+        "description": "Does nothing",
+        "parameters": {
+            "type": "object",
+            "properties": {},
+            "required": []
+        }
+    },
+    "list": {
+        "name": "list",
+        "description": "List files in specified module(s)",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "module": {
+                    "type": "string",
+                    "description": "Module name argument. Can be the name of any module that you have read-access to. Can also be one of the following special keywords: `.children` denotes all children of the current module; `.` denotes the current module; `*` denotes all modules that you have read-access to."
+                }
+            },
+            "required": [
+                "module"
+            ]
+        }
+    },
+    "read": {
+        "name": "read",
+        "description": "Read file(s)",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "module": {
+                    "type": "string",
+                    "description": "Module name argument. Can be the name of any module that you have read-access to. Can also be one of the following special keywords: `.children` denotes all children of the current module; `.` denotes the current module; `*` denotes all modules that you have read-access to."
+                },
+                "path": {
+                    "type": "string",
+                    "description": "Name of the file. This argument supports the `*` wildcard, so patterns like `*.txt` may be used. Must **not** contain `/`."
+                }
+            },
+            "required": [
+                "module",
+                "path"
+            ]
+        }
+    },
+    "read_lines": {
+        "name": "read_lines",
+        "description": "Read file(s), segmented into individual numbered lines",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "module": {
+                    "type": "string",
+                    "description": "Module name argument. Can be the name of any module that you have read-access to. Can also be one of the following special keywords: `.children` denotes all children of the current module; `.` denotes the current module; `*` denotes all modules that you have read-access to."
+                },
+                "path": {
+                    "type": "string",
+                    "description": "Name of the file. This argument supports the `*` wildcard, so patterns like `*.txt` may be used. Must **not** contain `/`."
+                },
+                "start_line": {
+                    "type": "integer",
+                    "description": "First line to read. If given without `count`, a page of 50 lines is read. Leave out both `start_line` and `count` to read the whole file."
+                },
+                "count": {
+                    "type": "integer",
+                    "description": "Number of lines to read, starting at `start_line` (or at the first line if `start_line` is not given)."
+                }
+            },
+            "required": [
+                "module",
+                "path"
+            ]
+        }
+    },
+    "write": {
+        "name": "write",
+        "description": "Write file",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "module": {
+                    "type": "string",
+                    "description": "Module name argument. Can be the name of any module that you have write-access to. Use `.` to denote the current module."
+                },
+                "path": {
+                    "type": "string",
+                    "description": "Name of the file. Wildcards not supported. Must **not** contain `/`."
+                },
+                "content": {
+                    "type": "string",
+                    "description": "Content to write to the file. **Content must be valid 8-bit ASCII.** Use a backslash to escape double quotes or other backslashes."
+                }
+            },
+            "required": [
+                "module",
+                "path",
+                "content"
+            ]
+        }
+    },
+    "append": {
+        "name": "append",
+        "description": "Append to file",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "module": {
+                    "type": "string",
+                    "description": "Module name argument. Can be the name of any module that you have write-access to. Use `.` to denote the current module."
+                },
+                "path": {
+                    "type": "string",
+                    "description": "Name of the file. Wildcards not supported. Must **not** contain `/`."
+                },
+                "content": {
+                    "type": "string",
+                    "description": "Content to append to the file. **Content must be valid 8-bit ASCII.** Use a backslash to escape double quotes or other backslashes."
+                }
+            },
+            "required": [
+                "module",
+                "path",
+                "content"
+            ]
+        }
+    },
+    "edit": {
+        "name": "edit",
+        "description": "Rewrite specified line(s) of a file. If you select to rewrite lines in the range [start_line, end_line] (inclusive), then the content you supply will directly replace these lines without modifying any other lines. **It is crucial that you take great care to provide the correct line indices, and provide content that correctly replaces the existing content of the lines in this range only.** Otherwise, you may unintentionally erase existing content or leave erroneous content in the file; either case could cause text to be illegible or cause code to not compile. The content you provide does not need to be a single line or have the same number of lines as the content being replaced.",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "module": {
+                    "type": "string",
+                    "description": "Module name argument. Can be the name of any module that you have write-access to. Use `.` to denote the current module."
+                },
+                "path": {
+                    "type": "string",
+                    "description": "Name of the file. Wildcards not supported. Must **not** contain `/`."
+                },
+                "new_lines": {
+                    "type": "array",
+                    "items": {
+                        "type": "string"
+                    },
+                    "description": "Content that will replace the specified file line range. **Content must be valid 8-bit ASCII.** Use a backslash to escape double quotes or other backslashes."
+                },
+                "start_line": {
+                    "type": "integer",
+                    "description": "First line to be replaced by your edit"
+                },
+                "end_line": {
+                    "type": "integer",
+                    "description": "Last line (inclusive) to be replaced by your edit; if set to -1, it is treated as the same value as start_line"
+                }
+            },
+            "required": [
+                "module",
+                "path",
+                "new_lines",
+                "start_line",
+                "end_line"
+            ]
+        }
+    },
+    "query_modules": {
+        "name": "query_modules",
+        "description": "List all existing modules and provide information on the local module topology",
+        "parameters": {
+            "type": "object",
+            "properties": {},
+            "required": []
+        }
+    },
+    "search": {
+        "name": "search",
+        "description": "Search file contents for words and return the best matching lines, each with a few lines of context. Prefer this over reading whole files when looking for something specific.",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "query": {
+                    "type": "string",
+                    "description": "Words to search for. Matching ignores case and punctuation; lines containing more of the words, and rarer words, rank higher."
+                },
+                "module": {
+                    "type": "string",
+                    "description": "Module name argument. Can be the name of any module that you have read-access to. Can also be one of the following special keywords: `.children` denotes all children of the current module; `.` denotes the current module; `*` denotes all modules that you have read-access to. Defaults to `*`."
+                },
+                "path": {
+                    "type": "string",
+                    "description": "Name of the file. This argument supports the `*` wildcard, so patterns like `*.txt` may be used. Must **not** contain `/`. Defaults to `*`."
+                },
+                "limit": {
+                    "type": "integer",
+                    "description": "Maximum number of matching lines to return (default 20, at most 100)."
+                },
+                "context": {
+                    "type": "integer",
+                    "description": "Number of lines to show before and after each match (default 1, at most 5)."
+                }
+            },
+            "required": [
+                "query"
+            ]
+        }
+    },
+    "create_module": {
+        "name": "create_module",
+        "description": "Create a new module",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "module_name": {
+                    "type": "string",
+                    "description": "Must not clash with any existing module names"
+                }
+            },
+            "required": [
+                "module_name"
+            ]
+        }
+    },
+    "answer": {
+        "name": "answer",
+        "description": "Answer either `yes` or `no`",
+        "parameters": {
+            "type": "object",
+            "properties": {
+                "answer": {
+                    "type": "string",
+                    "enum": [
+                        "yes",
+                        "no"
+                    ]
+                }
+            },
+            "required": [
+                "answer"
+            ]
+        }
     }
-  ]
-}]
+}
 )RAW";
 
-#endif
\ No newline at end of file
+#endif
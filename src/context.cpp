@@ -0,0 +1,236 @@
+#include <iostream>
+#include <algorithm>
+#include "defs.hpp"
+#include "json.hpp"
+#include "metrics.hpp"
+
+/*
+context window budgeting
+
+every agent context only ever grows, and the whole list is resent on every await. before each request is built, the context is
+measured against the agent's token budget and, if it is over, compacted in two escalating passes:
+
+ 1. large action outputs outside the recent tail are elided down to a short head
+ 2. if that is not enough, the oldest messages after the context head are collapsed into a single digest message
+
+the first CONTEXT_HEAD elements (the module introduction and the agent's acknowledgement) and the most recent
+HLL_CONTEXT_KEEP_RECENT elements are never touched. compaction mutates the context in place, so it is persisted with it.
+
+token counts are estimated from byte counts; the bytes-per-token ratio is calibrated against the usageMetadata that comes back
+with every reply.
+*/
+
+const size_t CONTEXT_HEAD = 2;
+const long DEFAULT_CONTEXT_BUDGET = 250000; // tokens; well below the model limit so cost and latency stay bounded
+const long DEFAULT_KEEP_RECENT = 8;
+const long DEFAULT_ELIDE_BYTES = 2048;
+const size_t ELIDED_HEAD_BYTES = 512;
+const size_t ELEMENT_OVERHEAD_TOKENS = 4;
+const size_t MAX_DIGEST_LINES = 32;
+const size_t MAX_DIGEST_LINE_BYTES = 160;
+const double DEFAULT_BYTES_PER_TOKEN = 4.0;
+
+const std::string COMPACTION_MARKER = "[Context compaction]";
+
+double bytespertoken = 0;
+
+double getbytespertoken() {
+    if (bytespertoken <= 0) {
+        bytespertoken = metricget("context.bytes_per_token"); // carry the calibration over from earlier runs of the project
+        if (bytespertoken <= 0) bytespertoken = DEFAULT_BYTES_PER_TOKEN;
+    }
+    return bytespertoken;
+}
+
+size_t elementbytes(const pjson& elem) {
+
+    size_t n = 0;
+    auto& d = elem->getDict();
+    auto it = d.find("parts");
+    if (it == d.end()) return 0;
+
+    for (const auto& p : it->second->getList()) {
+        auto& pd = p->getDict();
+        auto t = pd.find("text");
+        if (t != pd.end() && t->second->getDtype() == json::dtype::lstring) n += t->second->getString().size();
+        else n += p->print().size();
+    }
+
+    return n;
+
+}
+
+size_t contextbytes(const pjson& ctx) {
+    size_t n = 0;
+    for (const auto& elem : ctx->getList()) n += elementbytes(elem);
+    return n;
+}
+
+size_t bytestotokens(size_t bytes) { return (size_t)(bytes / getbytespertoken()); }
+
+size_t elementtokens(const pjson& elem) { return bytestotokens(elementbytes(elem)) + ELEMENT_OVERHEAD_TOKENS; }
+
+size_t estimatetokens(const pjson& ctx) {
+    size_t n = 0;
+    for (const auto& elem : ctx->getList()) n += elementtokens(elem);
+    return n;
+}
+
+size_t contextbudget(const std::string& agent) { // HLL_CONTEXT_BUDGET_<agent> overrides HLL_CONTEXT_BUDGET for a single agent; 0 disables compaction
+    long budget = envint("HLL_CONTEXT_BUDGET", DEFAULT_CONTEXT_BUDGET);
+    budget = envint(("HLL_CONTEXT_BUDGET_" + agent).c_str(), budget);
+    return budget > 0 ? (size_t)budget : 0;
+}
+
+void recordusage(const pjson& usage, size_t ctxbytes) {
+
+    if (!usage || usage->getDtype() != json::dtype::dict) return;
+    auto& u = usage->getDict();
+
+    auto count = [&](const char* key) -> int64_t {
+        auto it = u.find(key);
+        return (it != u.end() && it->second->getDtype() == json::dtype::lint) ? it->second->getInt() : 0;
+    };
+
+    int64_t prompttokens = count("promptTokenCount");
+    metricadd("api.prompt_tokens", prompttokens);
+    metricadd("api.candidate_tokens", count("candidatesTokenCount"));
+    metricadd("api.total_tokens", count("totalTokenCount"));
+    metricadd("api.cached_tokens", count("cachedContentTokenCount")); // covers both implicit and explicit prefix caching
+
+    if (prompttokens > 0 && ctxbytes > 0) { // exponential moving average so one odd reply can't swing the estimate
+        double observed = (double)ctxbytes / (double)prompttokens;
+        bytespertoken = 0.8 * getbytespertoken() + 0.2 * std::clamp(observed, 1.0, 8.0);
+        metricset("context.bytes_per_token", bytespertoken);
+    }
+
+}
+
+bool isactioncall(const pjson& elem) {
+
+    auto& d = elem->getDict();
+    if (d["role"]->getString() != "model") return false;
+    for (const auto& p : d["parts"]->getList())
+        if (p->getDict().count("functionCall")) return true;
+    return false;
+
+}
+
+std::string digestline(const pjson& elem) {
+
+    auto& d = elem->getDict();
+    std::string line = "- " + d["role"]->getString() + ": ";
+    auto& parts = d["parts"]->getList();
+    if (parts.empty()) return line;
+
+    auto& p = parts[0]->getDict();
+    std::string text;
+    if (p.count("text")) text = p["text"]->getString();
+    else if (p.count("functionCall")) text = "called `" + p["functionCall"]->getDict()["name"]->getString() + "`";
+
+    auto nl = text.find('\n');
+    if (nl != std::string::npos) text = text.substr(0, nl) + " ...";
+    if (text.size() > MAX_DIGEST_LINE_BYTES) text = text.substr(0, MAX_DIGEST_LINE_BYTES) + " ...";
+
+    return line + text;
+
+}
+
+bool issummary(const pjson& elem) {
+    auto& parts = elem->getDict()["parts"]->getList();
+    if (parts.empty()) return false;
+    auto& p = parts[0]->getDict();
+    return p.count("text") && p["text"]->getString().rfind(COMPACTION_MARKER, 0) == 0;
+}
+
+extern pjson gencontextelement(const std::string& text, bool isuser); // api.cpp
+
+void elideoutputs(std::vector<pjson>& l, size_t end) { // pass 1: action outputs are the user messages directly following an agent function call
+
+    size_t elidebytes = (size_t)std::max(envint("HLL_CONTEXT_ELIDE_BYTES", DEFAULT_ELIDE_BYTES), (long)ELIDED_HEAD_BYTES);
+    bool afteraction = false;
+
+    for (size_t i = CONTEXT_HEAD; i < end; i++) {
+
+        auto& d = l[i]->getDict();
+        if (d["role"]->getString() == "model") { afteraction = isactioncall(l[i]); continue; }
+        if (!afteraction) continue;
+
+        for (auto& p : d["parts"]->getList()) {
+            auto& pd = p->getDict();
+            if (!pd.count("text")) continue;
+            std::string text = pd["text"]->getString();
+            if (text.size() <= elidebytes) continue;
+            pd["text"] = json::makeString(
+                text.substr(0, ELIDED_HEAD_BYTES) +
+                "\n[... " + std::to_string(text.size() - ELIDED_HEAD_BYTES) + " bytes of action output elided to fit the context budget ...]"
+            );
+            metricadd("context.elided_outputs");
+        }
+
+    }
+
+}
+
+void collapseturns(std::vector<pjson>& l, size_t end, size_t budget) { // pass 2: oldest messages after the head are replaced by a digest
+
+    size_t tokens = 0;
+    for (const auto& elem : l) tokens += elementtokens(elem);
+
+    std::vector<std::string> digest;
+    size_t cut = CONTEXT_HEAD;
+
+    while (cut < end && tokens > budget) {
+
+        if (issummary(l[cut])) { // fold an earlier digest into the new one instead of nesting them
+            std::istringstream ss(l[cut]->getDict()["parts"]->getList()[0]->getDict()["text"]->getString());
+            std::string line;
+            while (std::getline(ss, line)) if (line.rfind("- ", 0) == 0) digest.push_back(line);
+        }
+        else digest.push_back(digestline(l[cut]));
+
+        tokens -= elementtokens(l[cut]);
+        cut++;
+
+    }
+
+    if (cut == CONTEXT_HEAD) return;
+
+    if (digest.size() > MAX_DIGEST_LINES) digest.erase(digest.begin(), digest.end() - MAX_DIGEST_LINES);
+
+    std::string text = COMPACTION_MARKER + " Earlier messages in this conversation were removed to fit the context budget. Digest of the most recent removed messages, oldest first:";
+    for (const auto& line : digest) text += "\n" + line;
+
+    metricadd("context.collapsed_messages", cut - CONTEXT_HEAD);
+    l.erase(l.begin() + CONTEXT_HEAD, l.begin() + cut);
+    l.insert(l.begin() + CONTEXT_HEAD, gencontextelement(text, true));
+
+}
+
+void compactcontext(pjson ctx, size_t budget) {
+
+    if (budget == 0) return;
+
+    auto& l = ctx->getList();
+    size_t tokens = estimatetokens(ctx);
+    metricset("context.last_estimated_tokens", tokens);
+    if (tokens <= budget) return;
+
+    size_t keeprecent = (size_t)std::max(envint("HLL_CONTEXT_KEEP_RECENT", DEFAULT_KEEP_RECENT), 0L);
+    if (l.size() <= CONTEXT_HEAD + keeprecent) return; // nothing compactable; the request goes out as-is
+    size_t end = l.size() - keeprecent;
+
+    size_t bytesbefore = contextbytes(ctx);
+
+    elideoutputs(l, end);
+    if (estimatetokens(ctx) > budget) collapseturns(l, end, budget);
+
+    size_t bytesafter = contextbytes(ctx);
+    size_t tokensafter = estimatetokens(ctx);
+
+    metricadd("context.compactions");
+    metricadd("context.bytes_saved", bytesbefore > bytesafter ? bytesbefore - bytesafter : 0);
+    metricadd("context.tokens_saved", tokens > tokensafter ? tokens - tokensafter : 0);
+    metricset("context.last_estimated_tokens", tokensafter);
+
+}
@@ -10,6 +10,7 @@
 #include <fstream>
 #include <sstream>
 #include <filesystem>
+#include <cstdlib>
 #include "json.hpp"
 
 // filepath defs
@@ -18,6 +19,22 @@
 #define hll_subdir "/hll/"
 #define hll_metadata_subdir "/.hll/"
 
+// runtime configuration defs; every runtime tunable is read from an environment variable
+
+inline long envint(const char* name, long fallback) {
+    const char* v = std::getenv(name);
+    if (!v || !*v) return fallback;
+    try { return std::stol(v); }
+    catch (...) { return fallback; }
+}
+
+inline double envfloat(const char* name, double fallback) {
+    const char* v = std::getenv(name);
+    if (!v || !*v) return fallback;
+    try { return std::stod(v); }
+    catch (...) { return fallback; }
+}
+
 // lexer defs
 
 #define rspc "( |\t)+"
@@ -113,6 +130,7 @@ struct dialogue { // master container for a parsed HLL dialogue
     std::set<int> entrypoints; // public label ids
     std::map<int, int> jumptable; // maps lid -> instruction index
     std::string code; // raw code
+    bool interactive = false; // talks to the user, so its model requests are scheduled ahead of batch agents
 };
 using dialogues = std::map<int, dialogue>;
 
@@ -154,8 +172,17 @@ struct inst_ctrlflow : public inst {
     inst_ctrlflow(ptok tok, int aid, int lid) : inst(tok), aid(aid), lid(lid) {}
 };
 
+struct awaitplan { // everything about a model request that depends only on the await instruction; compiled once at parse time
+    std::string responsetype; // "reply", "action" or "branch"
+    pjson expecting; // names of the functions the agent may call
+    pjson defaultparams; // action name -> arguments already supplied by the dialogue
+    std::string instruction; // text of the user turn appended right before the request; a fresh element every time, since compaction edits elements in place
+    std::string tools; // pre-serialized `tools` payload with default-supplied arguments pruned; empty for replies
+};
+
 struct inst_await : public inst {
     ptok k;
+    awaitplan plan;
     inst_await(ptok k) : inst(await), k(k) {}
 };
 
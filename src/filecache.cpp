@@ -0,0 +1,105 @@
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <list>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "defs.hpp"
+#include "metrics.hpp"
+
+/*
+read-through file cache
+
+agents in a `recurse` fan-out read the same files of `global` and of their parent modules over and over, and `read`
+returns whole files. cachedread() keeps the formatted result of reading a file (the header followed by its contents)
+in memory, least recently used first out once the total passes HLL_FILE_CACHE_MB (`0` turns the cache off). every
+hit still stats the file and is only served while its inode, size and mtime match what was read, so changes made
+behind the action layer's back (plugins, the user, a restored snapshot) are never hidden; write, append and edit drop
+the entry for the file they changed right away. `hll stats` reports filecache.hits and filecache.misses.
+*/
+
+struct cachedfile {
+    std::string path;
+    ino_t inode = 0;
+    off_t size = -1;
+    struct timespec mtime = {};
+    size_t headerlength = 0;
+    std::string formatted; // header + contents
+};
+
+std::list<cachedfile> filecache; // most recently used first
+std::unordered_map<std::string, std::list<cachedfile>::iterator> filecacheindex;
+size_t filecachebytes = 0;
+
+size_t filecachelimit() {
+    static size_t limit = (size_t)std::max(0L, envint("HLL_FILE_CACHE_MB", 64)) << 20;
+    return limit;
+}
+
+void filecacheforget(const std::string& path) { // the action layer changed the file
+    auto it = filecacheindex.find(path);
+    if (it == filecacheindex.end()) return;
+    filecachebytes -= it->second->formatted.size();
+    filecache.erase(it->second);
+    filecacheindex.erase(it);
+}
+
+bool readall(int fd, std::string& out, off_t size) {
+    out.resize(out.size() + size);
+    size_t got = out.size() - size;
+    while (got < out.size()) {
+        ssize_t r = ::read(fd, out.data() + got, out.size() - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return false;
+        if (r == 0) break; // shrank since the stat
+        got += r;
+    }
+    out.resize(got);
+    return true;
+}
+
+bool cachedread(const std::string& path, const std::string& header, std::string& out) { // out = header + the file's contents; false (with errno set) if it can't be read
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { int e = errno; ::close(fd); errno = e; return false; }
+
+    auto it = filecacheindex.find(path);
+    if (it != filecacheindex.end()) {
+        auto& f = *it->second;
+        if (f.inode == st.st_ino && f.size == st.st_size && f.mtime.tv_sec == st.st_mtim.tv_sec && f.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            ::close(fd);
+            filecache.splice(filecache.begin(), filecache, it->second);
+            if (f.headerlength == header.size() && f.formatted.compare(0, f.headerlength, header) == 0) out = f.formatted;
+            else out = header + f.formatted.substr(f.headerlength);
+            metricadd("filecache.hits");
+            return true;
+        }
+        filecacheforget(path);
+    }
+
+    out = header;
+    bool ok = readall(fd, out, st.st_size);
+    int e = errno;
+    ::close(fd);
+    if (!ok) { errno = e; return false; }
+    metricadd("filecache.misses");
+
+    size_t limit = filecachelimit();
+    if (out.size() > limit / 8) return true; // one file shouldn't push out everything else
+
+    filecache.push_front({ path, st.st_ino, st.st_size, st.st_mtim, header.size(), out });
+    filecacheindex[path] = filecache.begin();
+    filecachebytes += out.size();
+    while (filecachebytes > limit) {
+        filecachebytes -= filecache.back().formatted.size();
+        filecacheindex.erase(filecache.back().path);
+        filecache.pop_back();
+        metricadd("filecache.evictions");
+    }
+    return true;
+
+}
@@ -0,0 +1,342 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "defs.hpp"
+#include "json.hpp"
+#include "server.hpp"
+#include "metrics.hpp"
+
+/*
+dependency graph updates and synchronization with the action server
+
+built-in actions change the graph in process through graphaddfile() and graphaddmodule(), which also move it to a new
+version. plugin actions run in the action server, which keeps its own copy of every project's dependency graph, keyed
+by the graph's id. requests normally carry only the id and the version the client holds; when an action changes the
+graph, the server bumps the version and replies with the list of changes (a delta), which is applied to the client's
+copy here and persisted with the rest of the instance.
+
+if the server doesn't have the graph at that version (it was restarted, or another process moved it on), it answers
+"resync" without running anything, and the request is sent once more with the full graph attached.
+
+delta operations:
+ - {"op": "add_file", "module": m, "file": f}
+ - {"op": "add_module", "module": m, "parent": p}
+
+membership and permission checks (graphhasmodule() and friends) go through an index of hash sets built from the graph
+the first time it is queried at a given version. every change made through this file updates the index in place, so
+it is never rebuilt during a run; a graph that is replaced or changes version behind our back gets a fresh index. the
+JSON lists stay the persisted form and keep their order, which action outputs depend on.
+
+file patterns (graphglob()) are compiled once into their literal runs and resolved against each module's file index:
+a pattern without `*` is a hash lookup, one with a literal prefix scans only the matching range of the sorted names,
+and one with a literal extension (`*.md`) scans only the files with that extension. matches are returned in list
+order, so the cost follows the number of candidates rather than the size of the project.
+*/
+
+extern void snapshotchanged(const std::string& module, const std::string& file); // snapshot.cpp
+
+struct globpattern { // `*` matches any run of characters; everything else is literal
+    std::vector<std::string> parts; // the literal runs around the stars; one part if there is no star
+    std::string extension; // what every match ends with after its last `.`, if the pattern pins that down
+
+    bool wild() const { return parts.size() > 1; }
+
+    bool match(const std::string& s) const {
+        if (!wild()) return s == parts[0];
+        const auto& first = parts.front();
+        const auto& last = parts.back();
+        if (s.size() < first.size() + last.size() || s.compare(0, first.size(), first) != 0 || s.compare(s.size() - last.size(), last.size(), last) != 0) return false;
+        size_t at = first.size(), end = s.size() - last.size();
+        for (size_t i = 1; i + 1 < parts.size(); i++) { // leftmost placement of each middle run is always good enough
+            at = s.find(parts[i], at);
+            if (at == std::string::npos || at + parts[i].size() > end) return false;
+            at += parts[i].size();
+        }
+        return true;
+    }
+};
+
+const globpattern& compileglob(const std::string& pattern) {
+
+    static std::unordered_map<std::string, globpattern> compiled;
+    auto it = compiled.find(pattern);
+    if (it != compiled.end()) return it->second;
+    if (compiled.size() >= 256) compiled.clear(); // patterns come from agents; don't let them pile up
+
+    globpattern g;
+    size_t from = 0, star;
+    while ((star = pattern.find('*', from)) != std::string::npos) {
+        g.parts.push_back(pattern.substr(from, star - from));
+        from = star + 1;
+    }
+    g.parts.push_back(pattern.substr(from));
+    auto dot = g.parts.back().rfind('.');
+    if (g.wild() && dot != std::string::npos) g.extension = g.parts.back().substr(dot + 1);
+
+    return compiled.emplace(pattern, std::move(g)).first->second;
+
+}
+
+std::string fileextension(const std::string& file) {
+    auto dot = file.rfind('.');
+    return dot == std::string::npos ? "" : file.substr(dot + 1);
+}
+
+struct fileindex { // one module's files; positions are indices into the graph's list
+    std::vector<std::string> names; // by position
+    std::unordered_map<std::string, int> positions;
+    std::vector<std::pair<std::string, int>> sorted; // (name, position), by name
+    std::unordered_map<std::string, std::vector<int>> byextension; // positions, ascending
+
+    void add(const std::string& file) {
+        int pos = (int)names.size();
+        names.push_back(file);
+        positions.emplace(file, pos);
+        std::pair<std::string, int> entry(file, pos);
+        sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), entry), std::move(entry));
+        byextension[fileextension(file)].push_back(pos);
+    }
+
+    std::vector<std::string> glob(const globpattern& g) const {
+
+        std::vector<int> hits;
+
+        if (!g.wild()) {
+            auto it = positions.find(g.parts[0]);
+            if (it != positions.end()) hits.push_back(it->second);
+        }
+        else if (!g.parts.front().empty()) {
+            const auto& prefix = g.parts.front();
+            for (auto it = std::lower_bound(sorted.begin(), sorted.end(), std::make_pair(prefix, -1)); it != sorted.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+                if (g.match(it->first)) hits.push_back(it->second);
+            std::sort(hits.begin(), hits.end());
+        }
+        else if (!g.extension.empty()) {
+            auto it = byextension.find(g.extension);
+            if (it != byextension.end()) for (int pos : it->second) if (g.match(names[pos])) hits.push_back(pos);
+        }
+        else for (int pos = 0; pos < (int)names.size(); pos++) if (g.match(names[pos])) hits.push_back(pos);
+
+        std::vector<std::string> out;
+        out.reserve(hits.size());
+        for (int pos : hits) out.push_back(names[pos]);
+        return out;
+
+    }
+};
+
+struct graphindex {
+    std::weak_ptr<json> owner; // can't be fooled by a new graph at a recycled address
+    int64_t version = -1;
+    std::unordered_map<std::string, int> ids; // interned module names
+    std::vector<char> listed; // id is in the graph's module list (the children and files maps may mention others)
+    std::vector<std::unordered_set<int>> children;
+    std::vector<fileindex> files;
+
+    int intern(const std::string& module) {
+        auto it = ids.find(module);
+        if (it != ids.end()) return it->second;
+        int id = (int)children.size();
+        ids.emplace(module, id);
+        listed.push_back(0);
+        children.emplace_back();
+        files.emplace_back();
+        return id;
+    }
+
+    int find(const std::string& module) const {
+        auto it = ids.find(module);
+        return it == ids.end() ? -1 : it->second;
+    }
+};
+
+std::vector<graphindex> graphindices; // one per live graph; there is rarely more than one
+
+int64_t graphversion(pjson dgraph) {
+    auto& g = dgraph->getDict();
+    auto v = g.find("version");
+    return v == g.end() ? -1 : v->second->getInt();
+}
+
+graphindex* findindex(pjson dgraph) { // the graph's index if it is up to date, else nullptr
+    for (auto& idx : graphindices)
+        if (idx.owner.lock() == dgraph) return idx.version == graphversion(dgraph) ? &idx : nullptr;
+    return nullptr;
+}
+
+graphindex& indexof(pjson dgraph) { // builds the index if necessary
+
+    if (auto idx = findindex(dgraph)) return *idx;
+
+    graphindices.erase(std::remove_if(graphindices.begin(), graphindices.end(), [&](const graphindex& idx) {
+        return idx.owner.expired() || idx.owner.lock() == dgraph;
+    }), graphindices.end());
+
+    auto& idx = graphindices.emplace_back();
+    idx.owner = dgraph;
+    idx.version = graphversion(dgraph);
+
+    auto& g = dgraph->getDict();
+    for (const auto& m : g["modules"]->getList()) idx.listed[idx.intern(m->getString())] = 1;
+    for (const auto& kv : g["children"]->getDict()) {
+        int parent = idx.intern(kv.first);
+        for (const auto& c : kv.second->getList()) idx.children[parent].insert(idx.intern(c->getString()));
+    }
+    for (const auto& kv : g["files"]->getDict()) {
+        int module = idx.intern(kv.first);
+        for (const auto& f : kv.second->getList()) idx.files[module].add(f->getString());
+    }
+    metricadd("graph.index_builds");
+    return idx;
+
+}
+
+void setgraphversion(pjson dgraph, int64_t version) { // keeps an up-to-date index current
+    auto idx = findindex(dgraph);
+    dgraph->getDict()["version"] = json::makeInt(version);
+    if (idx) idx->version = version;
+}
+
+bool graphhasmodule(pjson dgraph, const std::string& module) {
+    auto& idx = indexof(dgraph);
+    int id = idx.find(module);
+    return id >= 0 && idx.listed[id];
+}
+
+bool graphischild(pjson dgraph, const std::string& parent, const std::string& child) {
+    auto& idx = indexof(dgraph);
+    int p = idx.find(parent), c = idx.find(child);
+    return p >= 0 && c >= 0 && idx.children[p].count(c) > 0;
+}
+
+bool graphhasfile(pjson dgraph, const std::string& module, const std::string& file) {
+    auto& idx = indexof(dgraph);
+    int id = idx.find(module);
+    return id >= 0 && idx.files[id].positions.count(file) > 0;
+}
+
+std::vector<std::string> graphglob(pjson dgraph, const std::string& module, const std::string& pattern) { // the module's files matching `pattern`, in list order
+    auto& idx = indexof(dgraph);
+    int id = idx.find(module);
+    if (id < 0) return {};
+    return idx.files[id].glob(compileglob(pattern));
+}
+
+bool graphcanwrite(pjson dgraph, const std::string& module, const std::string& target) { // a module may write to itself, its children and `global`
+    return module == target || target == "global" || graphischild(dgraph, module, target);
+}
+
+std::string newgraphid(const std::string& proot) { // qualified by the project, so graphs of different projects never share an id on the server
+    return proot + ":" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+}
+
+void ensuregraphid(pjson dgraph, const std::string& proot) { // graphs from before versioning get an identity on first use; it is persisted on the next save
+
+    auto& g = dgraph->getDict();
+    if (g.find("id") == g.end()) g["id"] = json::makeString(newgraphid(proot));
+    if (g.find("version") == g.end()) setgraphversion(dgraph, 0);
+
+}
+
+void attachgraph(pjson data, pjson dgraph, bool full) {
+
+    auto& dd = data->getDict();
+    auto& g = dgraph->getDict();
+    dd["graph_id"] = g["id"];
+    dd["graph_version"] = g["version"];
+    if (full) dd["dependency_graph"] = dgraph;
+    else dd.erase("dependency_graph");
+
+}
+
+void addfile(pjson dgraph, const std::string& module, const std::string& file) {
+    dgraph->getDict()["files"]->getDict()[module]->getList().push_back(json::makeString(file));
+    if (auto idx = findindex(dgraph)) idx->files[idx->intern(module)].add(file);
+}
+
+void addmodule(pjson dgraph, const std::string& parent, const std::string& module) {
+    auto& g = dgraph->getDict();
+    g["modules"]->getList().push_back(json::makeString(module));
+    g["files"]->getDict()[module] = json::makeList();
+    g["children"]->getDict()[module] = json::makeList();
+    g["children"]->getDict()[parent]->getList().push_back(json::makeString(module));
+    if (auto idx = findindex(dgraph)) {
+        int id = idx->intern(module);
+        idx->listed[id] = 1;
+        idx->children[idx->intern(parent)].insert(id);
+    }
+}
+
+void bumpgraphversion(pjson dgraph) { // the server's copy no longer matches, so the next request that needs it resends the graph
+    setgraphversion(dgraph, std::max<int64_t>(graphversion(dgraph), 0) + 1);
+}
+
+void graphaddfile(pjson dgraph, const std::string& module, const std::string& file) {
+    addfile(dgraph, module, file);
+    bumpgraphversion(dgraph);
+}
+
+void graphaddmodule(pjson dgraph, const std::string& parent, const std::string& module) {
+    addmodule(dgraph, parent, module);
+    bumpgraphversion(dgraph);
+}
+
+void applygraphdelta(pjson dgraph, pjson delta, int64_t version) {
+
+    for (const auto& op : delta->getList()) {
+
+        auto& o = op->getDict();
+        auto kind = o["op"]->getString();
+
+        if (kind == "add_file") {
+            addfile(dgraph, o["module"]->getString(), o["file"]->getString());
+            snapshotchanged(o["module"]->getString(), o["file"]->getString());
+        }
+        else if (kind == "add_module") addmodule(dgraph, o["parent"]->getString(), o["module"]->getString());
+        else throw std::runtime_error("Unknown dependency graph update `" + kind + "` from server");
+
+    }
+
+    setgraphversion(dgraph, version);
+    metricadd("graph.delta_ops", delta->getList().size());
+
+}
+
+pjson postwithgraph(pjson req, pjson dgraph) { // posts a request that operates on the dependency graph and applies the changes it made
+
+    auto data = req->getDict()["data"];
+    auto proot = data->getDict().find("project_root");
+    ensuregraphid(dgraph, proot == data->getDict().end() ? "" : proot->second->getString());
+
+    attachgraph(data, dgraph, false);
+    auto resp = json::loadFromString(post(req->dump()));
+
+    if (resp->getDict()["status"]->getString() == "resync") {
+        metricadd("graph.full_syncs");
+        attachgraph(data, dgraph, true);
+        resp = json::loadFromString(post(req->dump()));
+    }
+
+    auto& rd = resp->getDict();
+    if (rd["status"]->getString() != "ok") return resp;
+
+    auto module = data->getDict().find("module");
+    if (module != data->getDict().end()) { // a plugin may have written any file its module can: its own, its children's and global's
+        auto m = module->second->getString();
+        snapshotchanged(m, "");
+        snapshotchanged("global", "");
+        auto& children = dgraph->getDict()["children"]->getDict();
+        auto c = children.find(m);
+        if (c != children.end()) for (const auto& child : c->second->getList()) snapshotchanged(child->getString(), "");
+    }
+
+    auto& respdata = rd["data"]->getDict();
+    if (respdata.find("graph_delta") != respdata.end())
+        applygraphdelta(dgraph, respdata["graph_delta"], respdata["graph_version"]->getInt());
+
+    return resp;
+
+}
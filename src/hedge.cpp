@@ -0,0 +1,88 @@
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <map>
+#include "defs.hpp"
+#include "metrics.hpp"
+
+/*
+hedged model requests
+
+a few generateContent calls take many times longer than the median, and an await has to sit through all of them. when
+hedging is enabled, a request that is still outstanding after the HLL_HEDGE_PERCENTILE-th percentile of recently
+observed latencies gets a duplicate; whichever of the two first returns a well-formed reply is used and the other one
+is cancelled.
+
+duplicates cost tokens, so every agent has a hedging budget: each request earns it HLL_HEDGE_BUDGET of a hedge (capped
+at MAX_HEDGE_CREDIT) and each hedge spends a whole one. hedge.issued and hedge.wins (globally and per agent) show how
+often the duplicate actually won.
+
+no hedging happens until MIN_LATENCY_SAMPLES latencies have been observed, and HLL_HEDGE_PERCENTILE = 0 (the default)
+disables it entirely.
+*/
+
+const double DEFAULT_HEDGE_BUDGET = 0.1; // hedges per request
+const double MAX_HEDGE_CREDIT = 2;
+const size_t LATENCY_WINDOW = 128;
+const size_t MIN_LATENCY_SAMPLES = 16;
+const double MIN_HEDGE_DELAY = 0.5; // seconds; very fast tails aren't worth a duplicate
+
+std::deque<double> latencies; // most recent successful request latencies, in seconds
+std::map<std::string, double> hedgecredit; // agent -> hedges it may still issue
+
+double latencypercentile(double p) {
+    if (latencies.empty()) return 0;
+    std::vector<double> sorted(latencies.begin(), latencies.end());
+    size_t i = std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + i, sorted.end());
+    return sorted[i];
+}
+
+void hedgerecord(double seconds) { // called with the latency of every successful request
+
+    latencies.push_back(seconds);
+    if (latencies.size() > LATENCY_WINDOW) latencies.pop_front();
+
+    metricset("api.latency_p50", latencypercentile(50));
+    metricset("api.latency_p99", latencypercentile(99));
+
+}
+
+double hedgedelay(const std::string& agent) { // returns how long to wait before hedging this agent's next request, or -1 for no hedging
+
+    double percentile = envfloat("HLL_HEDGE_PERCENTILE", 0);
+    if (percentile <= 0 || percentile >= 100) return -1;
+
+    double budget = envfloat("HLL_HEDGE_BUDGET", DEFAULT_HEDGE_BUDGET);
+    budget = envfloat(("HLL_HEDGE_BUDGET_" + agent).c_str(), budget);
+    auto& credit = hedgecredit[agent];
+    credit = std::min(MAX_HEDGE_CREDIT, credit + std::max(budget, 0.0));
+
+    if (latencies.size() < MIN_LATENCY_SAMPLES) return -1;
+    return std::max(MIN_HEDGE_DELAY, latencypercentile(percentile));
+
+}
+
+bool hedgespend(const std::string& agent) {
+
+    auto& credit = hedgecredit[agent];
+    if (credit < 1) {
+        metricadd("hedge.budget_denied");
+        return false;
+    }
+    credit -= 1;
+    return true;
+
+}
+
+void hedgeoutcome(const std::string& agent, bool hedgewon) { // called once per issued hedge
+
+    metricadd("hedge.issued");
+    metricadd("hedge." + agent + ".issued");
+    if (hedgewon) {
+        metricadd("hedge.wins");
+        metricadd("hedge." + agent + ".wins");
+    }
+
+}
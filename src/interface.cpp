@@ -7,9 +7,12 @@
 #include <unistd.h>
 #include <cstdlib>
 #include <csignal>
+#include <chrono>
+#include <map>
 #include "defs.hpp"
 #include "json.hpp"
 #include "server.hpp"
+#include "metrics.hpp"
 
 // SIGINT handler that exits cleanly
 void handle_sigint(int) {
@@ -19,6 +22,18 @@ void handle_sigint(int) {
 
 extern void parse(dialogues&, const std::vector<std::string>&);
 extern void dispatch(dialogues&, pjson, pjson, const std::string&);
+extern std::string newgraphid(const std::string& proot); // graph.cpp
+extern void storeinit(const std::string& proot, const std::string& dir); // store.cpp
+extern pjson storeimportfiles(const std::string& proot, const std::string& module, const std::vector<std::pair<std::string, std::string>>& files);
+extern int copyfile(const std::string& src, const std::string& dst);
+extern void savestore();
+extern std::string storedir(const std::string& proot);
+extern size_t storegc(const std::string& dir);
+extern void restoresnapshot(const std::string& proot, int64_t id); // snapshot.cpp
+extern void listsnapshots(const std::string& proot);
+extern void printsnapshotdiff(const std::string& proot, int64_t a, int64_t b);
+extern bool removetree(const std::string& dir); // trash.cpp
+extern bool removelater(const std::string& dir, const std::string& store);
 
 void discoverfilenames(std::vector<std::string>& filenames, const std::string& dir) { // chatgpt
     DIR* dp = opendir(dir.c_str());
@@ -36,8 +51,8 @@ void discoverfilenames(std::vector<std::string>& filenames, const std::string& d
     closedir(dp);
 }
 
-void copyfiles(const std::vector<std::string>& includes, const std::string& dir, bool hllonly) { // chatgpt
-    mkdir(dir.c_str(), 0755); // create dir if not exists
+std::vector<std::pair<std::string, std::string>> listfiles(const std::vector<std::string>& includes, bool hllonly) { // chatgpt; (path, name) of every file to copy
+    std::vector<std::pair<std::string, std::string>> found;
 
     for (const auto& path : includes) {
         DIR* dp = opendir(path.c_str());
@@ -48,17 +63,28 @@ void copyfiles(const std::vector<std::string>& includes, const std::string& dir,
             std::string name = entry->d_name;
             if (entry->d_type == DT_REG && name.size() > 4) {
                 if (hllonly && name.substr(name.size() - 4) != ".hll") continue;
-                std::ifstream src(path + "/" + name, std::ios::binary);
-                std::ofstream dst(dir + "/" + name, std::ios::binary);
-                dst << src.rdbuf();
+                found.push_back({ path + "/" + name, name });
             }
         }
 
         closedir(dp);
     }
+    return found;
+}
+
+void copyfiles(const std::vector<std::string>& includes, const std::string& dir, bool hllonly) {
+    mkdir(dir.c_str(), 0755); // create dir if not exists
+    for (const auto& file : listfiles(includes, hllonly))
+        if (copyfile(file.first, dir + "/" + file.second) < 0) std::cerr << "Failed to copy " << file.first << "\n";
 }
 
-bool deletefolder(const std::string& dir, bool force) { // chatgpt
+std::string megabytes(long long bytes) {
+    char out[32];
+    std::snprintf(out, sizeof(out), "%.1f MB", bytes / 1048576.0);
+    return out;
+}
+
+bool deletefolder(const std::string& dir, bool force, const std::string& store, bool wait) { // chatgpt; store: collected once dir is gone
     if (!force) {
         std::cout << "Are you sure? Type \"I am sure\" to proceed: ";
         std::string confirmation;
@@ -75,11 +101,11 @@ bool deletefolder(const std::string& dir, bool force) { // chatgpt
         return true;
     }
 
-    std::string command = "rm -rf \"" + dir + "\"";
-    int ret = system(command.c_str());
-    if (ret != 0) {
+    if (!wait && removelater(dir, store)) return true; // see trash.cpp
+    if (!removetree(dir)) {
         std::cerr << "Failed to delete folder: " << dir << "\n";
     }
+    if (!store.empty()) storegc(store); // blobs only this project linked to
     return true;
 }
 
@@ -101,6 +127,15 @@ void create(const std::string& pname, const std::string& root, const std::vector
         parse(d, includes);
     }
 
+    std::vector<std::string> plugindirs; // plugins travel with the dialogues, all into one directory; see plugins.cpp
+    for (const auto& path : includes)
+        if (std::filesystem::is_directory(path + "/plugins")) plugindirs.push_back(path + "/plugins");
+    std::map<std::string, std::string> pluginfiles; // name -> the file it would be copied from
+    for (const auto& file : listfiles(plugindirs, false)) {
+        auto seen = pluginfiles.emplace(file.second, file.first);
+        if (!seen.second) throw std::runtime_error("Plugin file '" + file.second + "' exists in both " + seen.first->second + " and " + file.first + "; rename one of them");
+    }
+
     std::string proot = canonical_root + hll_subdir + pname + "/";
 
     auto dependencygraph = json::makeDict();
@@ -126,14 +161,24 @@ void create(const std::string& pname, const std::string& root, const std::vector
     dependencygraph->getDict()["files"] = files;
     dependencygraph->getDict()["dependencies"] = dependencies;
     dependencygraph->getDict()["children"] = children;
+    dependencygraph->getDict()["id"] = json::makeString(newgraphid(proot)); // identifies the graph to the server, which keeps its own copy
+    dependencygraph->getDict()["version"] = json::makeInt(0);
     dependencygraph->save(proot + hll_metadata_subdir + "dependency_graph.json", true);
 
     copyfiles(includes, proot + hll_metadata_subdir, true);
-    copyfiles({canonical_root}, proot, false);
+    if (!plugindirs.empty()) copyfiles(plugindirs, proot + hll_metadata_subdir + "plugins", false);
+    storeinit(proot, canonical_root + hll_subdir + ".blobs/"); // shared by the projects created from this root; see store.cpp
+    mkdir(proot.c_str(), 0755);
+    auto report = storeimportfiles(proot, "global", listfiles({ canonical_root }, false))->getDict(); // reflinked or copied in parallel, and only hashed with HLL_CREATE_DEDUP
+    savestore();
 
     dict[pname] = json::makeString(proot);
     projects->save(hll_projects_folder "projects.json", true);
 
+    std::cout << "Created project " << pname << ": " << report["files"]->getInt() << " files, " << megabytes(report["bytes"]->getInt())
+        << " in " << report["ms"]->getInt() << " ms (" << megabytes(report["stored"]->getInt()) << " already stored, "
+        << megabytes(report["cloned"]->getInt()) << " reflinked, " << megabytes(report["copied"]->getInt()) << " copied).\n";
+
 }
 
 void run(const std::string& pname, const std::string& agent, const std::string& label) {
@@ -195,7 +240,7 @@ void run(const std::string& pname, const std::string& agent, const std::string&
 
 }
 
-void resume(const std::string& pname) {
+void resume(const std::string& pname, int64_t from) { // from: a snapshot to roll the project back to first, or -1
 
     auto projects = json::loadFromFile(hll_projects_folder "projects.json", true);
     auto& dict = projects->getDict();
@@ -204,6 +249,7 @@ void resume(const std::string& pname) {
         throw std::runtime_error("Project with name '" + pname + "' does not exist");
 
     std::string proot = dict[pname]->getString();
+    if (from >= 0) restoresnapshot(proot, from);
     dialogues d;
     parse(d, { proot + hll_metadata_subdir });
 
@@ -244,7 +290,7 @@ void query() {
 
 }
 
-void delete_(const std::string& pname, bool force) {
+void stats(const std::string& pname) {
 
     auto projects = json::loadFromFile(hll_projects_folder "projects.json", true);
     auto& dict = projects->getDict();
@@ -252,7 +298,42 @@ void delete_(const std::string& pname, bool force) {
     if (dict.find(pname) == dict.end())
         throw std::runtime_error("Project with name '" + pname + "' does not exist");
 
-    if (!deletefolder(dict[pname]->getString(), force)) return;
+    printmetrics(dict[pname]->getString());
+
+}
+
+std::string projectroot(const std::string& pname) {
+
+    auto projects = json::loadFromFile(hll_projects_folder "projects.json", true);
+    auto& dict = projects->getDict();
+
+    if (dict.find(pname) == dict.end())
+        throw std::runtime_error("Project with name '" + pname + "' does not exist");
+
+    return dict[pname]->getString();
+
+}
+
+int64_t snapshotarg(const std::string& arg) {
+    try {
+        size_t used = 0;
+        long long id = std::stoll(arg, &used);
+        if (used == arg.size() && id > 0) return id;
+    }
+    catch (...) { }
+    throw std::runtime_error("Invalid snapshot id '" + arg + "'");
+}
+
+void delete_(const std::string& pname, bool force, bool wait) {
+
+    auto projects = json::loadFromFile(hll_projects_folder "projects.json", true);
+    auto& dict = projects->getDict();
+
+    if (dict.find(pname) == dict.end())
+        throw std::runtime_error("Project with name '" + pname + "' does not exist");
+
+    std::string store = storedir(dict[pname]->getString());
+    if (!deletefolder(dict[pname]->getString(), force, store, wait)) return;
     dict.erase(pname);
     projects->save(hll_projects_folder "projects.json");
 
@@ -262,7 +343,7 @@ int main(int argc, char** argv) { // chatgpt
     std::signal(SIGINT, handle_sigint);
 
     if (argc < 2) {
-        std::cerr << "No command provided. Usage [create/run/resume/query/delete/kill_server]\n";
+        std::cerr << "No command provided. Usage [create/run/resume/query/stats/snapshots/diff/delete/start_server/kill_server]\n";
         return 1;
     }
 
@@ -274,7 +355,11 @@ int main(int argc, char** argv) { // chatgpt
     }
 
     try {
-        if (cmd == "create") {
+        if (cmd == "start_server") { // warms up the action server ahead of the first run
+            double ms = ensure_server();
+            if (ms < 0) std::cout << "Server already running.\n";
+            else std::cout << "Server started in " << ms << " ms.\n";
+        } else if (cmd == "create") {
             if (argc < 4) throw std::runtime_error("Usage: create [pname] [root] [-I include1 -I include2 ...]");
 
             std::string pname = argv[2];
@@ -300,13 +385,28 @@ int main(int argc, char** argv) { // chatgpt
 
             run(pname, agent, label);
         } else if (cmd == "resume") {
-            if (argc != 3) throw std::runtime_error("Usage: resume [pname]");
-            resume(argv[2]);
+            if (argc != 3 && !(argc == 5 && std::string(argv[3]) == "--from")) throw std::runtime_error("Usage: resume [pname] [--from snapshot (optional)]");
+            resume(argv[2], argc == 5 ? snapshotarg(argv[4]) : -1);
+        } else if (cmd == "snapshots") {
+            if (argc != 3) throw std::runtime_error("Usage: snapshots [pname]");
+            listsnapshots(projectroot(argv[2]));
+        } else if (cmd == "diff") {
+            if (argc != 5) throw std::runtime_error("Usage: diff [pname] [snapshot] [snapshot]");
+            printsnapshotdiff(projectroot(argv[2]), snapshotarg(argv[3]), snapshotarg(argv[4]));
         } else if (cmd == "query") {
             query();
+        } else if (cmd == "stats") {
+            if (argc != 3) throw std::runtime_error("Usage: stats [pname]");
+            stats(argv[2]);
         } else if (cmd == "delete") {
-            if (argc < 3 || argc > 4) throw std::runtime_error("Usage: delete [pname] [--force (optional)]");
-            delete_(argv[2], argc == 4 ? (std::string(argv[3]) == "--force") : false);
+            if (argc < 3) throw std::runtime_error("Usage: delete [pname] [--force (optional)] [--wait (optional)]");
+            bool force = false, wait = false;
+            for (int i = 3; i < argc; ++i) {
+                if (std::string(argv[i]) == "--force") force = true;
+                else if (std::string(argv[i]) == "--wait") wait = true;
+                else throw std::runtime_error("Usage: delete [pname] [--force (optional)] [--wait (optional)]");
+            }
+            delete_(argv[2], force, wait);
         } else {
             throw std::runtime_error("Unknown command: " + cmd);
         }
@@ -317,64 +417,3 @@ int main(int argc, char** argv) { // chatgpt
 
     return 0;
 }
-/*
-#include "server.hpp"
-
-void handler(int) {
-    std::cout << std::endl;
-    std::exit(0);
-}
-
-#include <chrono>
-
-class Timer {
-public:
-    Timer() {
-        start_time = std::chrono::steady_clock::now();
-    }
-
-    // Returns elapsed time in milliseconds since the timer was constructed
-    long long check_time() const {
-        auto now = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
-        return duration.count();
-    }
-
-private:
-    std::chrono::steady_clock::time_point start_time;
-};
-
-int mainn(int argc, char** argv) { // DUMMY MAIN FUNCTION -- TEST SERVER FUNCTIONALITY
-
-    if (std::string(argv[1]) == "--kill") {
-        kill_server();
-        return 0;
-    }
-
-    std::signal(SIGINT, handler);
-
-    try {
-        
-        post(R"({"me":"warmup"})");
-
-        const int N = 2000;
-        auto start = std::chrono::steady_clock::now();
-        for (int i = 0; i < N; ++i)
-            post(R"({"me":"dummy"})");
-        auto end = std::chrono::steady_clock::now();
-
-        auto total_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-        std::cout << "Avg µs/req: " << (double)total_us / N << '\n';
-
-    }
-    catch (const std::exception& e) { 
-        
-        std::cout << "Error: " << e.what() << "\n"; 
-        return 1;
-        
-    }
-
-    return 0;
-
-}
-*/
\ No newline at end of file
@@ -6,8 +6,13 @@
 #include "rex.hpp"
 #include "json.hpp"
 #include "server.hpp"
+#include "metrics.hpp"
+#include "actions.hpp"
 
-extern bool apirequest(const std::string& proot, const std::string& curmodule, pjson& dgraph, pjson ctx, ptok k, const std::vector<actiondata>& actions);
+extern pjson postwithgraph(pjson req, pjson dgraph); // graph.cpp
+extern void savestore(); // store.cpp
+extern pjson takesnapshot(const std::string& proot, pjson dgraph, const std::string& where); // snapshot.cpp
+extern bool apirequest(const std::string& proot, const std::string& curmodule, const std::string& agent, bool interactive, pjson& dgraph, pjson ctx, const inst_await& in);
 extern pjson gencontextelement(const std::string& text, bool isuser = true);
 extern pjson gendefaultcontext(const std::string& module);
 
@@ -161,39 +166,12 @@ struct interpreter {
 
                 auto x = std::dynamic_pointer_cast<inst_await>(in);
 
-                switch (x->k) {
-
-                    case reply: {
-
-                        static std::vector<actiondata> no_actions; // this is so dumb
-                        apirequest(proot, curmodule, dgraph, ctx, reply, no_actions);
-                        break;
-
-                    }
-                    case action: {
-
-                        apirequest(
-                            proot,
-                            curmodule,
-                            dgraph,
-                            ctx,
-                            action,
-                            std::dynamic_pointer_cast<inst_awaitaction>(in)->actions
-                        );
-                        break;
-
-                    }
-                    case branch: {
-
-                        static std::vector<actiondata> answer_action = { actiondata { "answer", json::makeDict() } };
-
-                        bool option = apirequest(proot, curmodule, dgraph, ctx, branch, answer_action);
-                        auto xx = std::dynamic_pointer_cast<inst_awaitbranch>(in);
-                        int lidnew = option ? xx->lidyes : xx->lidno; 
-                        curinst = d[aid].jumptable[lidnew] - 1; // -1 for curinst++
-
-                    }
+                bool option = apirequest(proot, curmodule, agentname(), d[aid].interactive, dgraph, ctx, *x);
 
+                if (x->k == branch) {
+                    auto xx = std::dynamic_pointer_cast<inst_awaitbranch>(in);
+                    int lidnew = option ? xx->lidyes : xx->lidno; 
+                    curinst = d[aid].jumptable[lidnew] - 1; // -1 for curinst++
                 }
 
                 shouldsave = true;
@@ -206,43 +184,28 @@ struct interpreter {
                 const auto& actions = x->actions;
                 pjson aj = json::makeList();
 
-                for (const auto& a : actions) {
-
-                    auto name = json::makeString(a.aname);
-                    auto args = a.args;
-                    auto d = json::makeDict();
-
-                    d->getDict()["name"] = name;
-                    d->getDict()["args"] = args;
-                    aj->getList().push_back(d);
-
-                }
+                for (size_t i = 0; i <= actions.size(); i++) { // built-in actions run natively; runs of plugin actions go to the server in one request
 
-                auto data = json::makeDict();
-                auto& dd = data->getDict();
-                
-                dd["project_root"] = json::makeString(proot);
-                dd["module"] = json::makeString(curmodule);
-                dd["dependency_graph"] = dgraph;
-                dd["actions"] = aj;
-
-                auto req = json::makeDict();
-                req->getDict()["request"] = json::makeString("run_user_action");
-                req->getDict()["data"] = data;
+                    if (i < actions.size() && !isbuiltinaction(actions[i].aname)) {
+                        auto d = json::makeDict();
+                        d->getDict()["name"] = json::makeString(actions[i].aname);
+                        d->getDict()["args"] = actions[i].args;
+                        aj->getList().push_back(d);
+                        continue;
+                    }
 
-                auto resp = json::loadFromString(post(req->print()));
-                auto& rd = resp->getDict();
-                
-                if (rd["status"]->getString() == "err")
-                    throw std::runtime_error("User action failed: " + rd["reason"]->getString());
+                    if (aj->getList().size() > 0) runuseractions(aj);
+                    aj = json::makeList();
 
-                auto& respdata = rd["data"]->getDict();
+                    if (i == actions.size()) break;
 
-                auto& newctx = respdata["new_context"]->getList();
-                for (auto c : newctx) ctx->getList().push_back(c);
+                    try {
+                        for (const auto& text : runbuiltinaction(actions[i].aname, proot, actions[i].args, curmodule, dgraph))
+                            ctx->getList().push_back(gencontextelement(text));
+                    }
+                    catch (const std::exception& e) { throw std::runtime_error(std::string("User action failed: ") + e.what()); }
 
-                if (respdata.find("dependency_graph") != respdata.end())
-                    dgraph = respdata["dependency_graph"];
+                }
 
                 shouldsave = true;
                 break;
@@ -359,6 +322,9 @@ struct interpreter {
         instance->save(subdir + "instance.json");
         dgraph->save(subdir + "dependency_graph.json"); 
         if (stack.size() > 0) ctx->save(getcontextfilename("", oldstacksize));
+        savestore();
+        if (stack.size() > 0) takesnapshot(proot, dgraph, agentname() + " in " + curmodule); // something to roll back to; see snapshot.cpp
+        savemetrics();
 
         pendingframes.clear();
         pendingctxname = "";
@@ -367,7 +333,32 @@ struct interpreter {
 
     }
 
+    void runuseractions(pjson aj) { // plugin actions, executed by the server
+
+        auto data = json::makeDict();
+        auto& dd = data->getDict();
+        
+        dd["project_root"] = json::makeString(proot);
+        dd["module"] = json::makeString(curmodule);
+        dd["actions"] = aj;
+
+        auto req = json::makeDict();
+        req->getDict()["request"] = json::makeString("run_user_action");
+        req->getDict()["data"] = data;
+
+        auto resp = postwithgraph(req, dgraph); // applies any changes to the dependency graph
+        auto& rd = resp->getDict();
+        
+        if (rd["status"]->getString() == "err")
+            throw std::runtime_error("User action failed: " + rd["reason"]->getString());
+
+        auto& newctx = rd["data"]->getDict()["new_context"]->getList();
+        for (auto c : newctx) ctx->getList().push_back(c);
+
+    }
+
     void loadagent() { aid = stack.back()->getDict()["agent"]->getInt(); }
+    std::string agentname() { return dialogue::agentnames.queryname(aid); }
     void loadinstruction() { curinst = stack.back()->getDict()["instruction"]->getInt(); }
     void loadmodulename() { curmodule = stack.back()->getDict()["module"]->getString(); }
 
@@ -393,6 +384,7 @@ struct interpreter {
 
 extern void dispatch(dialogues& d, pjson instance, pjson dgraph, const std::string& proot) {
 
+    loadmetrics(proot);
     interpreter i(proot, instance, d, dgraph);
     while (i.step());
 
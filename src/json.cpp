@@ -76,6 +76,31 @@ void render(const shared_ptr<json> &node, stringstream &out, int indent, int dep
     }
 }
 
+void renderCompact(const shared_ptr<json> &node, string &out) {
+    switch (node->getDtype()) {
+        case json::dtype::dict: {
+            out += '{'; bool first = true;
+            for (const auto &kv : node->getDict()) {
+                if (!first) out += ','; first = false;
+                out += '"'; out += escapeString(kv.first); out += "\":";
+                renderCompact(kv.second, out);
+            }
+            out += '}'; break; }
+        case json::dtype::list: {
+            out += '['; bool first = true;
+            for (const auto &el : node->getList()) {
+                if (!first) out += ','; first = false;
+                renderCompact(el, out);
+            }
+            out += ']'; break; }
+        case json::dtype::lstring: out += '"'; out += escapeString(node->getString()); out += '"'; break;
+        case json::dtype::lint:    out += to_string(node->getInt()); break;
+        case json::dtype::ldouble: { stringstream ss; ss << node->getFloat(); out += ss.str(); break; }
+        case json::dtype::lbool:   out += node->getBool() ? "true" : "false"; break;
+        case json::dtype::lnull:   out += "null"; break;
+    }
+}
+
 inline bool match(const string &src, size_t &pos, char expected) {
     skipWs(src, pos); if (pos < src.size() && src[pos] == expected) { ++pos; return true; } return false;
 }
@@ -209,6 +234,13 @@ string json::print() {
     return out.str();
 }
 
+string json::dump() {
+    string out;
+    shared_ptr<json> self(this, [](json*){});
+    renderCompact(self, out);
+    return out;
+}
+
 void json::save(const std::string& filepath_in, bool force) {
     auto filepath = expand_user_path(filepath_in);
     auto create_directories = [](const std::string& path) {
@@ -45,6 +45,7 @@ struct json {
     void setBool(bool);
 
     std::string print(); // outputs formatted json string with readable tabbing
+    std::string dump(); // outputs compact json string; keys are always emitted in sorted order, so equal values always serialize to identical bytes
     void save(const std::string& filepath, bool force = false); // if force is true, it creates all intermediate directories
 
 protected:
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <cmath>
+#include "defs.hpp"
+#include "json.hpp"
+#include "metrics.hpp"
+
+std::map<std::string, double> metrics;
+std::string metricspath;
+
+void metricadd(const std::string& key, double amount) { metrics[key] += amount; }
+void metricset(const std::string& key, double value) { metrics[key] = value; }
+
+double metricget(const std::string& key) {
+    auto it = metrics.find(key);
+    return (it != metrics.end()) ? it->second : 0;
+}
+
+void loadmetrics(const std::string& proot) {
+
+    metricspath = proot + hll_metadata_subdir + "metrics.json";
+    metrics.clear();
+
+    pjson m;
+    try { m = json::loadFromFile(metricspath, true); }
+    catch (...) { return; } // a corrupt metrics file is not worth failing a run over; it gets overwritten on the next save
+
+    for (const auto& kv : m->getDict()) {
+        auto ty = kv.second->getDtype();
+        if (ty == json::dtype::lint) metrics[kv.first] = kv.second->getInt();
+        else if (ty == json::dtype::ldouble) metrics[kv.first] = kv.second->getFloat();
+    }
+
+}
+
+void savemetrics() {
+
+    if (metricspath.empty()) return;
+
+    auto m = json::makeDict();
+    for (const auto& kv : metrics) { // counters are stored as integers whenever possible so large totals don't lose precision when printed
+        double ip;
+        if (std::modf(kv.second, &ip) == 0 && std::fabs(ip) < 9e15) m->getDict()[kv.first] = json::makeInt((int64_t)ip);
+        else m->getDict()[kv.first] = json::makeFloat(kv.second);
+    }
+
+    try { m->save(metricspath); }
+    catch (...) { }
+
+}
+
+void printmetrics(const std::string& proot) {
+
+    auto m = json::loadFromFile(proot + hll_metadata_subdir + "metrics.json", true);
+
+    if (m->getDict().empty()) {
+        std::cout << "No metrics recorded\n";
+        return;
+    }
+
+    for (const auto& kv : m->getDict()) {
+        std::cout << kv.first << " : ";
+        if (kv.second->getDtype() == json::dtype::lint) std::cout << kv.second->getInt();
+        else std::cout << kv.second->print();
+        std::cout << "\n";
+    }
+
+}
@@ -0,0 +1,16 @@
+#ifndef _metrics_inc
+#define _metrics_inc
+
+#include <string>
+
+// process-wide runtime counters; they are seeded from and persisted to the project's metadata folder so totals survive `resume`
+
+void metricadd(const std::string& key, double amount = 1);
+void metricset(const std::string& key, double value);
+double metricget(const std::string& key);
+
+void loadmetrics(const std::string& proot); // also selects the file that savemetrics() writes to
+void savemetrics();
+void printmetrics(const std::string& proot);
+
+#endif
@@ -3,9 +3,11 @@
 #include "json.hpp"
 #include "server.hpp"
 #include "validate.hpp"
+#include "actions.hpp"
 
 extern void lex(std::vector<ptoklex>&, const std::string&, const std::string&); // lexer.cpp
 extern void analyze(dialogue&, const std::string&); // analysis.cpp
+extern pjson loadplugincommands(const std::vector<std::string>& paths, const pjson& builtins); // plugins.cpp
 
 namespace fs = std::filesystem;
 
@@ -69,24 +71,93 @@ std::string invalid_target(std::string filename, std::string type, std::string n
 
 pjson ALL_COMMANDS;
 pjson ALL_LEGAL_COMMANDS; // excludes `answer` which cannot be explicitly called except by the runtime
+pjson ALL_LEGAL_COMMANDS_V; // names of all legal commands, for awaits that don't restrict which one the agent calls
 
-void loadcommands() {
+void loadcommands(const std::vector<std::string>& paths = {}) { // built-ins plus the plugins next to the dialogues in `paths`; see plugins.cpp
 
-    auto data = json::makeDict();
-    data->getDict()["request"] = json::makeString("get_commands");
-    data->getDict()["data"] = json::makeDict();
-
-    auto res = json::loadFromString(post(data->print()));
-    if (res->getDict()["status"]->getString() != "ok")
-        throw std::runtime_error(
-            res->getDict()["reason"]->getString()
-        );
-
-    ALL_COMMANDS = res->getDict()["data"];
+    ALL_COMMANDS = json::makeDict();
+    ALL_COMMANDS->getDict() = builtincommands()->getDict(); // builtincommands() is shared; don't add the plugins to it
+    auto plugins = loadplugincommands(paths, ALL_COMMANDS);
+    for (const auto& k : plugins->getDict()) ALL_COMMANDS->getDict()[k.first] = k.second;
 
     ALL_LEGAL_COMMANDS = json::makeDict();
     for (const auto& k : ALL_COMMANDS->getDict())
         if (k.first != "answer") ALL_LEGAL_COMMANDS->getDict()[k.first] = k.second;
+    ALL_LEGAL_COMMANDS_V = nullptr;
+
+}
+
+
+void gencmdstr(std::string& s, pjson expecting) {
+
+    auto& l = expecting->getList();
+
+    for (int i = 0; i < l.size(); i++) {
+        
+        auto cmd = l[i];
+        s += "`" + cmd->getString() + "`";
+        if (i < l.size() - 1) s += ", ";
+
+    }
+
+}
+
+void compileawait(inst_await& in, const std::vector<actiondata>& actions) { // precomputes everything apirequest needs, so building a request at runtime is just concatenation
+
+    auto& plan = in.plan;
+    bool needscall = in.k != reply;
+
+    plan.responsetype = needscall ? (in.k == action ? "action" : "branch") : "reply";
+    plan.expecting = json::makeList();
+    plan.defaultparams = json::makeDict();
+
+    if (!needscall) {
+        plan.instruction = "Please answer in plaintext, without calling any functions.";
+        return;
+    }
+
+    if (!ALL_LEGAL_COMMANDS) loadcommands();
+
+    if (actions.size() == 0) {
+        if (!ALL_LEGAL_COMMANDS_V) {
+            ALL_LEGAL_COMMANDS_V = json::makeList();
+            for (const auto& cmd : ALL_LEGAL_COMMANDS->getDict()) ALL_LEGAL_COMMANDS_V->getList().push_back(json::makeString(cmd.first));
+        }
+        plan.expecting = ALL_LEGAL_COMMANDS_V;
+    }
+    else for (const auto& a : actions) plan.expecting->getList().push_back(json::makeString(a.aname));
+
+    pjson tools = json::loadFromString("[{ \"function_declarations\": [] }]");
+    auto& funcdeclars = tools->getList()[0]->getDict()["function_declarations"]->getList();
+
+    for (const auto& a : actions) {
+
+        auto candidates = json::loadFromString(ALL_COMMANDS->getDict()[a.aname]->dump()); // deep copy; only happens once per instruction
+
+        for (const auto& arg : a.args->getDict()) { // arguments supplied by the dialogue are hidden from the agent
+
+            candidates->getDict()["parameters"]->getDict()["properties"]->getDict().erase(arg.first);
+
+            auto& required_args = candidates->getDict()["parameters"]->getDict()["required"]->getList();
+            for (auto rarg = required_args.begin(); rarg != required_args.end(); rarg++)
+                if ((*rarg)->getString() == arg.first) {
+                    required_args.erase(rarg);
+                    break;
+                }
+
+        }
+
+        funcdeclars.push_back(candidates);
+        plan.defaultparams->getDict()[a.aname] = a.args;
+
+    }
+
+    plan.tools = tools->dump();
+
+    std::string instruction = "In your next reply, you are **required** to call one of the following functions: ";
+    gencmdstr(instruction, plan.expecting);
+    instruction += " using the Gemini function calling API.\nIMPORTANT: The values of string arguments should escape all internal back-slashes (`\\`) and quotes (`\"`). Otherwise, your reply will not be parsed correctly.";
+    plan.instruction = instruction;
 
 }
 
@@ -164,6 +235,7 @@ void parse(dialogues& d, const std::vector<std::string>& paths) {
 
     std::vector<std::string> filenames;
     queryfilenames(filenames, paths);
+    loadcommands(paths);
 
     std::vector<std::string> files(filenames.size());
     loadfiles(files, filenames);
@@ -497,6 +569,27 @@ void parse(dialogues& d, const std::vector<std::string>& paths) {
         }
     }
 
+    static const std::vector<actiondata> no_actions;
+    const std::vector<actiondata> answer_action = { actiondata { "answer", json::makeDict() } };
+
+    for (auto& it : d) for (auto& in : it.second.instructions) { // compile request plans for every await
+        if (in->tok != await) continue;
+        auto x = std::dynamic_pointer_cast<inst_await>(in);
+        switch (x->k) {
+            case action: compileawait(*x, std::dynamic_pointer_cast<inst_awaitaction>(in)->actions); break;
+            case branch: compileawait(*x, answer_action); break;
+            default: compileawait(*x, no_actions);
+        }
+    }
+
+    for (auto& it : d) { // scheduling priority: dialogues that wait on the user are interactive unless HLL_PRIORITY_<agent> says otherwise
+        for (auto& in : it.second.instructions)
+            if (in->tok == getreply || in->tok == pause_ || in->tok == prompt || in->tok == useraction || in->tok == userbranch) it.second.interactive = true;
+        auto priority = std::getenv(("HLL_PRIORITY_" + dialogue::agentnames.queryname(it.first)).c_str());
+        if (priority && std::string(priority) == "interactive") it.second.interactive = true;
+        else if (priority && std::string(priority) == "batch") it.second.interactive = false;
+    }
+
     for (auto& it : d) // static analysis
         analyze(it.second, dialogue::agentnames.queryname(it.first));
 
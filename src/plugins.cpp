@@ -0,0 +1,138 @@
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include "defs.hpp"
+#include "json.hpp"
+#include "server.hpp"
+#include "metrics.hpp"
+
+/*
+plugin commands
+
+plugins are python files in a `plugins` directory next to the dialogues; project creation copies them to the project's
+.hll/plugins, and the action server runs them (see server.py, PluginRegistry). parsing only needs their function
+declarations, which are cached on disk in ~/.local/share/hll/schema_cache/, keyed by a fingerprint of the plugin
+directory: the name and content of every plugin file (plugins are small, and a content key survives the copy into a new
+project). the server is only asked for the declarations (load_plugins) when that fingerprint is new, i.e. a plugin file
+was added, removed or changed, so projects without plugins, or whose plugins haven't changed, are parsed without
+starting the server. cache entries that haven't been used for a month are removed whenever a new one is written.
+
+the schema hash the server published for the declarations is sent along with every plugin call, so a call is refused
+if the plugins changed after the dialogues were parsed.
+*/
+
+namespace fs = std::filesystem;
+
+extern std::string expand_user_path(const std::string& path); // json.cpp
+
+std::string pluginschemahash; // of the plugins the dialogues were last parsed with; empty if there are none
+
+std::string pluginfingerprint(const std::string& dir) { // empty if the directory holds no plugins
+
+    std::vector<std::string> entries;
+    for (const auto& entry : fs::directory_iterator(dir))
+        if (entry.is_regular_file() && entry.path().extension() == ".py") entries.push_back(entry.path().filename().string());
+    if (entries.empty()) return "";
+    std::sort(entries.begin(), entries.end());
+
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    auto mix = [&](const std::string& s) {
+        for (unsigned char c : s) { h ^= c; h *= 1099511628211ULL; }
+        h ^= 0xff; h *= 1099511628211ULL; // separator, so entries can't run into each other
+    };
+    for (const auto& e : entries) {
+        std::ifstream in(dir + "/" + e, std::ios::binary);
+        std::stringstream content;
+        content << in.rdbuf();
+        mix(e);
+        mix(content.str());
+    }
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+    return hex;
+
+}
+
+void pruneschemacache(const fs::path& dir) {
+    std::error_code ec;
+    auto cutoff = fs::file_time_type::clock::now() - std::chrono::hours(24 * 30);
+    for (const auto& entry : fs::directory_iterator(dir, ec))
+        if (entry.last_write_time(ec) < cutoff) fs::remove(entry.path(), ec);
+}
+
+pjson pluginschema(const std::string& dir, const std::string& fingerprint) { // { commands, schema_hash }, from the cache if possible
+
+    std::string cachefile = expand_user_path(hll_projects_folder "schema_cache/") + fingerprint + ".json";
+
+    try {
+        auto cached = json::loadFromFile(cachefile);
+        cached->getDict().at("commands")->getDict();
+        cached->getDict().at("schema_hash")->getString();
+        fs::last_write_time(cachefile, fs::file_time_type::clock::now()); // keeps it from being pruned
+        metricadd("plugins.cache_hits");
+        return cached;
+    }
+    catch (...) { } // missing or unreadable; ask the server
+
+    auto req = json::makeDict();
+    req->getDict()["request"] = json::makeString("load_plugins");
+    req->getDict()["data"] = json::makeDict();
+    req->getDict()["data"]->getDict()["plugin_dir"] = json::makeString(dir);
+
+    auto resp = json::loadFromString(post(req->dump()));
+    auto& rd = resp->getDict();
+    if (rd["status"]->getString() != "ok") throw std::runtime_error(rd["reason"]->getString());
+
+    metricadd("plugins.cache_misses");
+    rd["data"]->save(cachefile, true);
+    pruneschemacache(fs::path(cachefile).parent_path());
+    return rd["data"];
+
+}
+
+pjson loadplugincommands(const std::vector<std::string>& paths, const pjson& builtins) { // name -> declaration of every plugin next to `paths`
+
+    auto commands = json::makeDict();
+    std::vector<std::string> hashes; // schema hash of every plugin directory, in include order
+    pluginschemahash.clear();
+
+    for (const auto& path : paths) {
+
+        std::error_code ec;
+        auto dir = fs::canonical(path + "/plugins", ec).string();
+        if (ec || !fs::is_directory(dir)) continue;
+
+        auto fingerprint = pluginfingerprint(dir);
+        if (fingerprint.empty()) continue;
+
+        auto schema = pluginschema(dir, fingerprint);
+        for (const auto& cmd : schema->getDict()["commands"]->getDict()) {
+            if (builtins->getDict().count(cmd.first) || commands->getDict().count(cmd.first))
+                throw std::runtime_error("Plugin command `" + cmd.first + "` in " + dir + " is already defined");
+            commands->getDict()[cmd.first] = cmd.second;
+        }
+        hashes.push_back(schema->getDict()["schema_hash"]->getString());
+
+    }
+
+    // a project's plugins are all in one directory, so at run time this is exactly the hash the server publishes for
+    // them; only `create`, which parses every include, can see several
+    if (hashes.size() == 1) pluginschemahash = hashes[0];
+    else if (!hashes.empty()) {
+        uint64_t h = 14695981039346656037ULL; // FNV-1a, as in pluginfingerprint()
+        for (const auto& s : hashes) {
+            for (unsigned char c : s) { h ^= c; h *= 1099511628211ULL; }
+            h ^= 0xff; h *= 1099511628211ULL;
+        }
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+        pluginschemahash = hex;
+    }
+    return commands;
+
+}
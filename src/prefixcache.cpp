@@ -0,0 +1,116 @@
+#include <iostream>
+#include <chrono>
+#include "defs.hpp"
+#include "json.hpp"
+#include "metrics.hpp"
+#include "retry.hpp"
+
+/*
+explicit provider-side caching of long shared context prefixes
+
+every request carries the system instruction, the tool declarations and the full context. the provider already applies
+implicit prefix caching to byte-identical prefixes (which is why requests are serialized with stable key ordering), but
+long-lived agents can also pin a prefix explicitly through the cachedContents API and reference it by handle, so the
+prefix is neither resent nor billed at the full rate.
+
+a cached prefix covers the system instruction, the tools and the first N context elements. it is identified by the
+running hash of those pieces, so any edit to the prefix (e.g. compaction) simply stops matching. a new cache is only
+created once the part of the context not covered by an existing cache reaches HLL_PREFIX_CACHE_MIN_TOKENS; setting
+that variable to 0 (the default) disables explicit caching.
+*/
+
+const long DEFAULT_PREFIX_CACHE_TTL = 600; // seconds
+const auto PREFIX_CACHE_EXPIRY_MARGIN = std::chrono::seconds(30); // stop using a handle a little before the provider drops it
+
+extern const std::string API_ROOT; // api.cpp
+extern const std::string MODEL;
+extern long curl_post_request(const std::string& url, const std::string& payload, std::string& response_body, httpreply* reply);
+extern size_t bytestotokens(size_t bytes); // context.cpp
+
+struct prefixentry {
+    std::string name;
+    std::chrono::steady_clock::time_point expires;
+};
+
+std::map<std::pair<size_t, uint64_t>, prefixentry> prefixentries; // (element count, running hash) -> cache handle
+
+uint64_t fnv1a(const std::string& s, uint64_t h = 1469598103934665603ULL) {
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ULL; }
+    return h;
+}
+
+bool createprefixcache(const std::vector<std::string>& elems, size_t count, const std::string& si, const std::string& tools, long ttl, std::string& name) {
+
+    std::string body = "{\"contents\":[";
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) body += ",";
+        body += elems[i];
+    }
+    body += "],\"model\":" + json::makeString(MODEL)->dump();
+    body += ",\"systemInstruction\":" + si;
+    if (!tools.empty()) body += ",\"tools\":" + tools;
+    body += ",\"ttl\":\"" + std::to_string(ttl) + "s\"}";
+
+    std::string response;
+    long http_code = curl_post_request(API_ROOT + "cachedContents", body, response, nullptr);
+    if (http_code != 200) {
+        std::cerr << "Failed to create context cache: Status code " << http_code << ". Continuing without it." << std::endl;
+        return false;
+    }
+
+    try {
+        name = json::loadFromString(response)->getDict()["name"]->getString();
+        return true;
+    }
+    catch (...) { return false; }
+
+}
+
+size_t prefixcache(const std::vector<std::string>& elems, const std::string& si, const std::string& tools, std::string& handle) { // returns how many leading elements are covered by `handle`
+
+    long mintokens = envint("HLL_PREFIX_CACHE_MIN_TOKENS", 0);
+    if (mintokens <= 0 || elems.size() < 2) return 0;
+
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = prefixentries.begin(); it != prefixentries.end();)
+        it = (it->second.expires <= now) ? prefixentries.erase(it) : std::next(it);
+
+    // the last element is always the per-request instruction, so it is never part of a cacheable prefix
+
+    size_t best = 0;
+    uint64_t h = fnv1a(tools, fnv1a(si));
+    std::vector<uint64_t> hashes(elems.size());
+
+    for (size_t i = 1; i < elems.size(); i++) {
+        h = fnv1a(elems[i - 1], h);
+        hashes[i] = h;
+        auto it = prefixentries.find({ i, h });
+        if (it != prefixentries.end()) { best = i; handle = it->second.name; }
+    }
+
+    size_t uncached = 0;
+    for (size_t i = best; i < elems.size() - 1; i++) uncached += elems[i].size();
+    if (best == 0) uncached += si.size() + tools.size();
+
+    if (bytestotokens(uncached) >= (size_t)mintokens) {
+        long ttl = envint("HLL_PREFIX_CACHE_TTL", DEFAULT_PREFIX_CACHE_TTL);
+        std::string name;
+        if (createprefixcache(elems, elems.size() - 1, si, tools, ttl, name)) {
+            best = elems.size() - 1;
+            handle = name;
+            prefixentries[{ best, hashes[best] }] = prefixentry { name, now + std::chrono::seconds(ttl) - PREFIX_CACHE_EXPIRY_MARGIN };
+            metricadd("prefix_cache.created");
+        }
+        else metricadd("prefix_cache.create_failures");
+    }
+
+    if (best > 0) {
+        metricadd("prefix_cache.hits");
+        metricadd("prefix_cache.cached_elements", best);
+    }
+
+    return best;
+
+}
+
+void dropprefixcaches() { prefixentries.clear(); }
@@ -0,0 +1,160 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "defs.hpp"
+#include "metrics.hpp"
+
+/*
+client-side rate limiting of outbound model requests
+
+two token buckets (requests per minute and tokens per minute) are shared by every hll process on the machine through a
+small state file that is only ever touched under flock. a request takes one request token and its estimated token count
+up front; once the reply's usageMetadata is known, the difference is settled so the token bucket tracks real usage.
+
+requests come in two priority classes. interactive agents (dialogues that talk to the user) may drain the buckets
+completely, while batch agents must leave HLL_RATE_RESERVE of each bucket untouched and stand back entirely whenever an
+interactive request has been waiting recently, so a human at the prompt is served first.
+
+both limits default to 0, which disables them.
+*/
+
+const double DEFAULT_RATE_RESERVE = 0.2; // fraction of each bucket that only interactive requests may use
+const double INTERACTIVE_WAITER_WINDOW = 2; // seconds during which a waiting interactive request holds back batch requests
+const double INTERACTIVE_POLL = 0.1;
+const double BATCH_POLL = 0.5;
+
+extern std::string expand_user_path(const std::string& path); // json.cpp
+
+struct ratestate {
+    double requests = 0, tokens = 0; // bucket contents; the token bucket goes negative when usage exceeded the estimates
+    double refilled = 0; // wall clock seconds of the last refill; 0 means the buckets were never used and start out full
+    double interactivewaiting = 0; // wall clock seconds at which an interactive request was last seen waiting
+};
+
+double wallclock() { return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count(); }
+
+template <class Fn>
+void withratestate(Fn&& fn) { // loads the shared state under an exclusive lock, lets fn modify it and writes it back
+
+    std::string path = expand_user_path(hll_projects_folder "ratelimit.state");
+    int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) { ratestate st; fn(st); return; } // no shared state available; limit this process on its own
+
+    ::flock(fd, LOCK_EX);
+
+    ratestate st;
+    char buf[256] = {};
+    if (::pread(fd, buf, sizeof(buf) - 1, 0) > 0)
+        std::sscanf(buf, "%lf %lf %lf %lf", &st.requests, &st.tokens, &st.refilled, &st.interactivewaiting);
+
+    fn(st);
+
+    int n = std::snprintf(buf, sizeof(buf), "%.3f %.3f %.3f %.3f\n", st.requests, st.tokens, st.refilled, st.interactivewaiting);
+    ::ftruncate(fd, 0);
+    ::pwrite(fd, buf, n, 0);
+
+    ::flock(fd, LOCK_UN);
+    ::close(fd);
+
+}
+
+void refill(ratestate& st, double rpm, double tpm, double now) {
+
+    if (st.refilled <= 0 || st.refilled > now) { // first use, or the clock went backwards
+        st.requests = rpm;
+        st.tokens = tpm;
+    }
+    else {
+        double elapsed = now - st.refilled;
+        st.requests = std::min(rpm, st.requests + elapsed * rpm / 60);
+        st.tokens = std::min(tpm, st.tokens + elapsed * tpm / 60);
+    }
+    st.refilled = now;
+
+}
+
+double ratelimittake(ratestate& st, bool interactive, size_t esttokens, double rpm, double tpm, double reserve) { // takes one request and its tokens from the buckets, or returns how long to wait before that is possible
+
+    double now = wallclock();
+    refill(st, rpm, tpm, now);
+
+    if (!interactive && now - st.interactivewaiting < INTERACTIVE_WAITER_WINDOW) return BATCH_POLL;
+
+    // a request larger than the whole token bucket is let through once the bucket is full, or it would wait forever
+    double tokensneeded = tpm > 0 ? std::min((double)esttokens, tpm * (1 - reserve)) : 0;
+
+    double reqwait = (rpm > 0 && st.requests - 1 < rpm * reserve) ? (rpm * reserve + 1 - st.requests) * 60 / rpm : 0;
+    double tokwait = (tpm > 0 && st.tokens - tokensneeded < tpm * reserve) ? (tpm * reserve + tokensneeded - st.tokens) * 60 / tpm : 0;
+    double wait = std::max(reqwait, tokwait);
+
+    if (wait <= 0) {
+        if (rpm > 0) st.requests -= 1;
+        if (tpm > 0) st.tokens -= esttokens;
+    }
+
+    return wait;
+
+}
+
+void ratelimitacquire(bool interactive, size_t esttokens) {
+
+    double rpm = envfloat("HLL_RATE_RPM", 0);
+    double tpm = envfloat("HLL_RATE_TPM", 0);
+    if (rpm <= 0 && tpm <= 0) return;
+
+    double reserve = interactive ? 0 : envfloat("HLL_RATE_RESERVE", DEFAULT_RATE_RESERVE);
+    double start = wallclock();
+    bool waited = false;
+
+    while (true) {
+
+        double wait = 0;
+
+        withratestate([&](ratestate& st) {
+            wait = ratelimittake(st, interactive, esttokens, rpm, tpm, reserve);
+            if (wait > 0 && interactive) st.interactivewaiting = wallclock();
+        });
+
+        if (wait <= 0) break;
+
+        if (!waited) {
+            metricadd(interactive ? "ratelimit.interactive_waits" : "ratelimit.batch_waits");
+            waited = true;
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(std::min(wait, interactive ? INTERACTIVE_POLL : BATCH_POLL)));
+
+    }
+
+    if (waited) metricadd("ratelimit.wait_seconds", wallclock() - start);
+
+}
+
+bool ratelimittryacquire(bool interactive, size_t esttokens) { // non-blocking variant for optional requests (hedges); they always leave the reserve untouched
+
+    double rpm = envfloat("HLL_RATE_RPM", 0);
+    double tpm = envfloat("HLL_RATE_TPM", 0);
+    if (rpm <= 0 && tpm <= 0) return true;
+
+    double reserve = envfloat("HLL_RATE_RESERVE", DEFAULT_RATE_RESERVE);
+    double wait = 0;
+    withratestate([&](ratestate& st) { wait = ratelimittake(st, interactive, esttokens, rpm, tpm, reserve); });
+    return wait <= 0;
+
+}
+
+void ratelimitsettle(size_t esttokens, size_t actualtokens) { // charges (or refunds) the difference between the estimate and the reported usage
+
+    double rpm = envfloat("HLL_RATE_RPM", 0);
+    double tpm = envfloat("HLL_RATE_TPM", 0);
+    if (tpm <= 0 || actualtokens == 0) return;
+
+    withratestate([&](ratestate& st) {
+        refill(st, rpm, tpm, wallclock());
+        st.tokens = std::min(tpm, st.tokens + (double)esttokens - (double)actualtokens);
+    });
+
+}
@@ -0,0 +1,151 @@
+#include <iostream>
+#include <algorithm>
+#include <curl/curl.h>
+#include "defs.hpp"
+#include "json.hpp"
+#include "retry.hpp"
+#include "metrics.hpp"
+
+const double DEFAULT_RETRY_BASE_DELAY = 1; // seconds
+const double DEFAULT_RETRY_MAX_DELAY = 64;
+const double DEFAULT_RETRY_MAX_HINT = 300; // server hints are honored even past the max delay, up to this bound
+const long DEFAULT_RETRY_MAX_ATTEMPTS = 10;
+const long DEFAULT_BREAKER_THRESHOLD = 5;
+const double DEFAULT_BREAKER_COOLDOWN = 30;
+const double DEFAULT_RETRY_BUDGET = 20;
+const double DEFAULT_RETRY_BUDGET_EARN = 0.2;
+
+retrypolicy::retrypolicy(retryclock& clock) : retrypolicy(clock, std::random_device{}()) { }
+
+retrypolicy::retrypolicy(retryclock& clock, uint64_t seed) :
+    basedelay(envfloat("HLL_RETRY_BASE_DELAY", DEFAULT_RETRY_BASE_DELAY)),
+    maxdelay(envfloat("HLL_RETRY_MAX_DELAY", DEFAULT_RETRY_MAX_DELAY)),
+    maxhint(DEFAULT_RETRY_MAX_HINT),
+    maxattempts((int)envint("HLL_RETRY_MAX_ATTEMPTS", DEFAULT_RETRY_MAX_ATTEMPTS)),
+    breakerthreshold((int)envint("HLL_RETRY_BREAKER_THRESHOLD", DEFAULT_BREAKER_THRESHOLD)),
+    breakercooldown(envfloat("HLL_RETRY_BREAKER_COOLDOWN", DEFAULT_BREAKER_COOLDOWN)),
+    budgetmax(envfloat("HLL_RETRY_BUDGET", DEFAULT_RETRY_BUDGET)),
+    budgetearn(DEFAULT_RETRY_BUDGET_EARN),
+    clock(clock),
+    rng(seed) {
+
+    prevdelay = basedelay;
+    budget = budgetmax;
+
+}
+
+failureclass retrypolicy::classify(const httpreply& r) {
+
+    if (r.code == 200) return failureclass::none;
+
+    if (r.code < 0) { // no response at all; only local misconfiguration is hopeless
+        switch (r.curlerr) {
+            case CURLE_UNSUPPORTED_PROTOCOL:
+            case CURLE_FAILED_INIT:
+            case CURLE_URL_MALFORMAT:
+            case CURLE_OUT_OF_MEMORY:
+                return failureclass::fatal;
+        }
+        return failureclass::transient;
+    }
+
+    if (r.code == 429) return failureclass::throttled;
+    if (r.code == 408 || r.code >= 500) return failureclass::transient;
+    return failureclass::fatal; // 400 (malformed body), 401/403 (bad key), 404, ...
+
+}
+
+double retrypolicy::parsehint(const httpreply& r) {
+
+    if (r.retryafter >= 0) return r.retryafter;
+    if (r.body.empty()) return -1;
+
+    try { // {"error": {"details": [{"@type": "...RetryInfo", "retryDelay": "31s"}]}}
+        auto body = json::loadFromString(r.body);
+        auto& details = body->getDict()["error"]->getDict()["details"]->getList();
+        for (const auto& d : details) {
+            auto& dd = d->getDict();
+            if (dd.find("retryDelay") == dd.end()) continue;
+            return std::stod(dd["retryDelay"]->getString()); // stod stops at the trailing 's'
+        }
+    }
+    catch (...) { }
+
+    return -1;
+
+}
+
+void retrypolicy::waitforbreaker() {
+
+    double now = clock.now();
+    if (openuntil <= now) return;
+
+    std::cerr << "Model API circuit breaker is open; waiting " << (int)(openuntil - now + 0.5) << " seconds before trying again." << std::endl;
+    metricadd("retry.breaker_waits");
+    clock.sleep(openuntil - now);
+
+}
+
+void retrypolicy::onsuccess() {
+
+    consecutivefailures = 0;
+    prevdelay = basedelay;
+    budget = std::min(budgetmax, budget + budgetearn);
+
+}
+
+double retrypolicy::onfailure(const httpreply& r, int attempt, std::string& giveup) {
+
+    auto cls = classify(r);
+    consecutivefailures++;
+
+    if (consecutivefailures >= breakerthreshold && openuntil <= clock.now()) {
+        openuntil = clock.now() + breakercooldown;
+        consecutivefailures = 0; // the first request after the cooldown is a single trial; it takes another full run of failures to reopen
+        metricadd("retry.breaker_trips");
+    }
+
+    if (cls == failureclass::fatal) {
+        metricadd("retry.fatal");
+        giveup = "the error is not retryable";
+        return -1;
+    }
+
+    metricadd(cls == failureclass::throttled ? "retry.throttled" : "retry.transient");
+
+    if (attempt + 1 >= maxattempts) {
+        metricadd("retry.giveups");
+        giveup = "gave up after " + std::to_string(attempt + 1) + " attempts";
+        return -1;
+    }
+
+    if (budget < 1) {
+        metricadd("retry.budget_exhausted");
+        metricadd("retry.giveups");
+        giveup = "the retry budget is exhausted";
+        return -1;
+    }
+    budget -= 1;
+
+    // decorrelated jitter: sleep = min(cap, uniform(base, 3 * previous sleep))
+    std::uniform_real_distribution<double> dist(basedelay, std::max(basedelay, prevdelay * 3));
+    double delay = std::min(maxdelay, dist(rng));
+    prevdelay = delay;
+
+    double hint = parsehint(r);
+    if (hint >= 0) {
+        metricadd("retry.server_hints");
+        delay = std::max(delay, std::min(hint, maxhint));
+    }
+
+    metricadd("retry.attempts");
+    metricadd("retry.sleep_seconds", delay);
+    return delay;
+
+}
+
+retrypolicy& apiretrypolicy() {
+    static systemclock clock;
+    static retrypolicy policy(clock);
+    return policy;
+}
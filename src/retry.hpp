@@ -0,0 +1,74 @@
+#ifndef _retry_inc
+#define _retry_inc
+
+#include <string>
+#include <random>
+#include <chrono>
+#include <thread>
+
+/*
+retry policy for outbound model requests
+
+ - failures are classified: throttling (429) and transient errors (timeouts, 5xx, network failures) are retried, anything
+   else (malformed request, bad API key, ...) fails immediately
+ - delays use decorrelated jitter, so independent runtimes don't retry in lockstep, and never undercut a server hint
+   (Retry-After or the RetryInfo detail in the error body)
+ - a per-process circuit breaker opens after several consecutive failures; while it is open, requests wait out the
+   cooldown instead of hammering the provider, and the first request after it closes is a single trial
+ - a retry budget bounds the total number of retries: every retry spends a token and every success earns back a fraction
+   of one, so a prolonged outage makes the runtime give up (the instance can be resumed later) rather than spin forever
+
+time is taken from a retryclock rather than read directly.
+*/
+
+struct retryclock {
+    virtual ~retryclock() = default;
+    virtual double now() = 0; // seconds
+    virtual void sleep(double seconds) = 0;
+};
+
+struct systemclock : public retryclock {
+    double now() override { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+    void sleep(double seconds) override { std::this_thread::sleep_for(std::chrono::duration<double>(seconds)); }
+};
+
+enum class failureclass { none, transient, throttled, fatal };
+
+struct httpreply { // everything the policy needs to know about one attempt
+    long code = 0; // -1 if the request never got a response
+    int curlerr = 0;
+    double retryafter = -1; // server hint in seconds, or -1
+    std::string body;
+};
+
+struct retrypolicy {
+
+    double basedelay, maxdelay, maxhint;
+    int maxattempts;
+    int breakerthreshold;
+    double breakercooldown;
+    double budgetmax, budgetearn;
+
+    retryclock& clock;
+    std::mt19937_64 rng;
+
+    double prevdelay;
+    int consecutivefailures = 0;
+    double openuntil = 0;
+    double budget;
+
+    retrypolicy(retryclock& clock); // tunables are read from HLL_RETRY_* environment variables
+    retrypolicy(retryclock& clock, uint64_t seed);
+
+    static failureclass classify(const httpreply& r);
+    static double parsehint(const httpreply& r); // Retry-After header, falling back to RetryInfo.retryDelay in the body
+
+    void waitforbreaker(); // blocks while the circuit breaker is open
+    void onsuccess();
+    double onfailure(const httpreply& r, int attempt, std::string& giveup); // returns the delay before the next attempt, or -1 with a reason in `giveup`
+
+};
+
+retrypolicy& apiretrypolicy(); // shared by every request the process makes
+
+#endif
@@ -0,0 +1,186 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "defs.hpp"
+#include "json.hpp"
+#include "metrics.hpp"
+
+/*
+inverted index behind the `search` action
+
+words (runs of letters, digits, `_` and non-ASCII bytes, at least two long, lowercased) map to the files that contain
+them, and every file maps its words to the lines they occur on. a file is indexed the first time a search covers it and
+again whenever its inode, size or mtime no longer match (the same staleness test as the line index in actions.cpp);
+write, append and edit re-index the file they touched right away. a search therefore reads only the files that changed
+since the last one, never the whole project.
+
+a matching line scores the sum of the weights of the distinct query words it contains, where a word's weight is
+log((1 + files searched) / (1 + files containing it)) + 1, so rare words count for more. ties keep the order of the
+files searched and then of the lines. server/fsop.py (cmd_search) ranks the same way and must stay in step.
+*/
+
+struct indexedfile {
+    ino_t inode = 0;
+    off_t size = -1;
+    struct timespec mtime = {};
+    std::unordered_map<std::string, std::vector<long>> lines; // word -> lines containing it, ascending
+};
+
+std::unordered_map<std::string, int> searchids; // path -> index into searchindex
+std::vector<indexedfile> searchindex;
+std::unordered_map<std::string, std::unordered_set<int>> postings; // word -> files containing it
+
+bool iswordbyte(unsigned char c) { return std::isalnum(c) || c == '_' || c >= 0x80; }
+
+template <typename F> void words(const char* s, size_t n, F&& each) { // each(word) for every word in s
+    size_t i = 0;
+    while (i < n) {
+        while (i < n && !iswordbyte(s[i])) i++;
+        size_t start = i;
+        while (i < n && iswordbyte(s[i])) i++;
+        if (i - start < 2) continue;
+        std::string w(s + start, i - start);
+        for (auto& c : w) if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        each(w);
+    }
+}
+
+void unindex(int id) {
+    for (const auto& kv : searchindex[id].lines) {
+        auto it = postings.find(kv.first);
+        if (it == postings.end()) continue;
+        it->second.erase(id);
+        if (it->second.empty()) postings.erase(it);
+    }
+    searchindex[id].lines.clear();
+}
+
+bool refresh(int id, const std::string& path) { // re-indexes the file if it changed; false if it can't be read
+
+    auto& f = searchindex[id];
+    struct stat st;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        unindex(id);
+        f.size = -1;
+        return false;
+    }
+
+    if (f.inode == st.st_ino && f.size == st.st_size && f.mtime.tv_sec == st.st_mtim.tv_sec && f.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        ::close(fd);
+        return true;
+    }
+
+    std::string content(st.st_size, '\0');
+    size_t got = 0;
+    while (got < content.size()) {
+        ssize_t r = ::read(fd, content.data() + got, content.size() - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        got += r;
+    }
+    ::close(fd);
+    content.resize(got);
+
+    unindex(id);
+    long line = 0;
+    size_t start = 0;
+    while (start < content.size()) {
+        auto nl = content.find('\n', start);
+        size_t end = nl == std::string::npos ? content.size() : nl + 1;
+        words(content.data() + start, end - start, [&](const std::string& w) {
+            auto& l = f.lines[w];
+            if (l.empty() || l.back() != line) l.push_back(line);
+        });
+        start = end;
+        line++;
+    }
+    for (const auto& kv : f.lines) postings[kv.first].insert(id);
+
+    f.inode = st.st_ino;
+    f.size = st.st_size;
+    f.mtime = st.st_mtim;
+    metricadd("search.files_indexed");
+    return true;
+
+}
+
+int searchid(const std::string& path) {
+    auto it = searchids.find(path);
+    if (it != searchids.end()) return it->second;
+    searchids.emplace(path, (int)searchindex.size());
+    searchindex.emplace_back();
+    return (int)searchindex.size() - 1;
+}
+
+void searchupdate(const std::string& path) { // called after a built-in action changed the file; only files searched before are tracked
+    auto it = searchids.find(path);
+    if (it != searchids.end()) refresh(it->second, path);
+}
+
+std::vector<std::string> searchwords(const std::string& query) { // distinct, in order of first occurrence
+    std::vector<std::string> out;
+    words(query.data(), query.size(), [&](const std::string& w) {
+        if (std::find(out.begin(), out.end(), w) == out.end()) out.push_back(w);
+    });
+    return out;
+}
+
+std::vector<std::pair<size_t, long>> searchlines(const std::vector<std::string>& paths, const std::string& query, size_t limit, size_t& total) { // best (index into paths, line) matches
+
+    auto q = searchwords(query);
+    if (q.empty()) throw std::runtime_error("Search query must contain at least one word.");
+
+    std::unordered_map<int, size_t> scope; // file id -> index into paths
+    for (size_t i = 0; i < paths.size(); i++) {
+        int id = searchid(paths[i]);
+        if (refresh(id, paths[i])) scope.emplace(id, i);
+    }
+
+    std::vector<std::vector<int>> holders(q.size()); // files in scope containing each word
+    for (size_t w = 0; w < q.size(); w++) {
+        auto it = postings.find(q[w]);
+        if (it == postings.end()) continue;
+        if (it->second.size() < scope.size()) { for (int id : it->second) if (scope.count(id)) holders[w].push_back(id); }
+        else for (const auto& s : scope) if (it->second.count(s.first)) holders[w].push_back(s.first);
+    }
+
+    std::unordered_map<int, std::vector<std::pair<long, double>>> scored; // file id -> (line, score) per matching word occurrence
+    for (size_t w = 0; w < q.size(); w++) {
+        double weight = std::log((1.0 + scope.size()) / (1.0 + holders[w].size())) + 1.0;
+        for (int id : holders[w])
+            for (long line : searchindex[id].lines[q[w]]) scored[id].push_back({ line, weight });
+    }
+
+    struct hit { size_t path; long line; double score; };
+    std::vector<hit> hits;
+    for (auto& kv : scored) {
+        auto& l = kv.second;
+        std::stable_sort(l.begin(), l.end(), [](const auto& a, const auto& b) { return a.first < b.first; }); // keeps query order within a line, so sums match python's
+        for (size_t i = 0; i < l.size();) {
+            hit h{ scope[kv.first], l[i].first, 0.0 };
+            for (; i < l.size() && l[i].first == h.line; i++) h.score += l[i].second;
+            hits.push_back(h);
+        }
+    }
+
+    std::sort(hits.begin(), hits.end(), [](const hit& a, const hit& b) {
+        if (a.score != b.score) return a.score > b.score;
+        if (a.path != b.path) return a.path < b.path;
+        return a.line < b.line;
+    });
+
+    total = hits.size();
+    std::vector<std::pair<size_t, long>> out;
+    for (size_t i = 0; i < hits.size() && i < limit; i++) out.push_back({ hits[i].path, hits[i].line });
+    metricadd("search.queries");
+    return out;
+
+}
@@ -3,8 +3,26 @@
 #define server_included
 
 #include <string>
+#include <cstdint>
+#include <ostream>
 
-std::string post(const std::string& data);
+std::string post(const std::string& data); // one request/response exchange over the process-wide connection to the action server
+uint32_t post_async(const std::string& data); // pipelined variant: sends the request and returns its id without waiting
+std::string wait_reply(uint32_t id); // response to a request sent with post_async(); responses may be collected in any order
+void disconnect(); // closes that connection; the next post() opens a new one
 void kill_server();
+double ensure_server(); // connects to the action server, starting it if necessary; returns its startup time in ms, or -1 if it was already running
+
+struct ipc_histogram { // post() round-trip latencies in power-of-two microsecond buckets
+    static const int BUCKETS = 32;
+    uint64_t counts[BUCKETS] = {};
+    uint64_t total = 0;
+
+    void record(double us);
+    double percentile(double p) const; // upper bound of the bucket holding the p-th percentile
+    void print(std::ostream& out) const;
+};
+
+const ipc_histogram& ipc_latencies();
 
 #endif // server_included
@@ -0,0 +1,518 @@
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <ctime>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "defs.hpp"
+#include "json.hpp"
+#include "metrics.hpp"
+
+/*
+module snapshots
+
+at every checkpoint the interpreter calls takesnapshot(), which records the project as it is then: every file of every
+module in the dependency graph, and every file of interpreter state in .hll/ (instance.json, dependency_graph.json and
+the context windows). a file is recorded by the hash of its blob in the project's content store (see store.cpp), so
+unchanged files are shared with the project and with every other snapshot, and every blob a snapshot names is pinned by
+a hard link in .hll/snapshots/pins/, which keeps storegc() from collecting it while the project exists.
+
+a module file costs no more than a stat() unless it changed. one that is a link to its blob (it was written through
+storeput()) is recorded by the manifest's hash, and one whose size and mtime match its last entry keeps that entry. a
+file `create` copied that nobody has touched since (its sourcekey() is the one the manifest recorded at import) isn't
+read either: its inode is pinned as it is, under the name i<dev>-<ino>, which stands in for the hash. only a file that
+changed behind the store's back, by a plugin, an append or an edit, is read, stored, and then replaced by a link to its
+blob, so its content isn't kept twice. every writer unshares a linked file before changing it, so pinned content never
+changes.
+
+a snapshot only looks at what can have changed since the one before: the files built-in actions wrote and the server
+added to the graph (snapshotchanged()), every file a plugin could have written (those of the module it ran in, its
+children and global), since plugins write files without telling us, and the state files, whose sourcekey() shows whether
+they were rewritten. it is saved in .hll/snapshots/<id>.json as a delta against its parent, the entries that changed
+with null for a file that is gone, and not at all if no file's content did. the first snapshot of a run (files may have
+been changed between runs) and every HLL_SNAPSHOT_BASE-th one after it walk the whole graph instead and are saved in
+full as the base later deltas build on. the newest HLL_SNAPSHOTS snapshots are kept, along with the base the oldest of
+them needs.
+
+a snapshot that can't pin a blob is dropped and counted as snapshots.failed in `hll stats`; what it would have recorded
+is picked up by the next one, so a checkpoint never fails because of its snapshot.
+
+`hll resume [pname] --from [id]` snapshots the project as it is, links back the files that differ in snapshot id,
+removes the ones it didn't have and restores the interpreter state, so the run continues from that checkpoint without
+repeating the model requests before it. the snapshot taken first means a rollback can itself be rolled back.
+projects created before the content store have no snapshots.
+*/
+
+extern std::string storedir(const std::string& proot); // store.cpp
+extern std::string blobpath(const std::string& dir, const std::string& hash);
+extern std::string modulepath(const std::string& proot, const std::string& module, const std::string& file);
+extern std::string sourcekey(const struct stat& st);
+extern std::string storefile(const std::string& dir, const std::string& path);
+extern bool storerestore(const std::string& proot, const std::string& module, const std::string& file, const std::string& hash);
+extern bool storerestorepinned(const std::string& proot, const std::string& module, const std::string& file, const std::string& pin);
+extern std::string storedhash(const std::string& proot, const std::string& module, const std::string& file);
+extern std::string storeimportedkey(const std::string& proot, const std::string& module, const std::string& file);
+extern int copyfile(const std::string& src, const std::string& dst);
+extern void savestore();
+extern std::string newgraphid(const std::string& proot); // graph.cpp
+
+std::string snapshotdir(const std::string& proot) { return proot + hll_metadata_subdir + "snapshots/"; }
+
+std::vector<int64_t> snapshotids(const std::string& proot) { // ascending
+    std::vector<int64_t> ids;
+    DIR* dp = ::opendir(snapshotdir(proot).c_str());
+    if (!dp) return ids;
+    struct dirent* entry;
+    while ((entry = ::readdir(dp)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name.size() > 5 && name.substr(name.size() - 5) == ".json" && std::all_of(name.begin(), name.end() - 5, ::isdigit))
+            ids.push_back(std::stoll(name.substr(0, name.size() - 5)));
+    }
+    ::closedir(dp);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+pjson readsnapshot(const std::string& proot, int64_t id) { // as saved, so possibly a delta
+    try { return json::loadFromFile(snapshotdir(proot) + std::to_string(id) + ".json"); }
+    catch (...) { throw std::runtime_error("Project has no snapshot " + std::to_string(id)); }
+}
+
+bool isdelta(const pjson& snapshot) { return snapshot->getDict().count("parent") > 0; }
+
+void applydelta(pjson snapshot, const pjson& delta) { // moves a full snapshot on to the one delta records
+
+    auto& sd = snapshot->getDict();
+    auto& dd = delta->getDict();
+    for (const auto& key : { "id", "time", "where" }) sd[key] = dd[key];
+
+    auto apply = [](pjson group, const pjson& changes) {
+        auto& g = group->getDict();
+        for (const auto& f : changes->getDict()) {
+            if (f.second->getDtype() == json::dtype::lnull) g.erase(f.first);
+            else g[f.first] = f.second;
+        }
+    };
+    auto& files = sd["files"]->getDict();
+    for (const auto& m : dd["files"]->getDict()) {
+        if (!files.count(m.first)) files[m.first] = json::makeDict();
+        apply(files[m.first], m.second);
+    }
+    apply(sd["state"], dd["state"]);
+
+}
+
+pjson loadsnapshot(const std::string& proot, int64_t id) { // in full: its base with every delta up to it applied
+    std::vector<pjson> deltas;
+    auto snapshot = readsnapshot(proot, id);
+    while (isdelta(snapshot)) {
+        deltas.push_back(snapshot);
+        snapshot = readsnapshot(proot, snapshot->getDict()["parent"]->getInt());
+    }
+    for (auto it = deltas.rbegin(); it != deltas.rend(); it++) applydelta(snapshot, *it);
+    return snapshot;
+}
+
+bool isstatefile(const std::string& name) { // interpreter state, as written by interpreter::save()
+    if (name == "instance.json" || name == "dependency_graph.json") return true;
+    return name.size() > 8 && name.substr(0, 3) == "ctx" && name.substr(name.size() - 5) == ".json";
+}
+
+std::vector<std::string> statefiles(const std::string& proot) {
+    std::vector<std::string> names;
+    DIR* dp = ::opendir((proot + hll_metadata_subdir).c_str());
+    if (!dp) return names;
+    struct dirent* entry;
+    while ((entry = ::readdir(dp)) != nullptr)
+        if (entry->d_type == DT_REG && isstatefile(entry->d_name)) names.push_back(entry->d_name);
+    ::closedir(dp);
+    return names;
+}
+
+pjson groupentry(const pjson& group, const std::string& name) { // [hash, key], or null if the group has no such file
+    if (!group) return nullptr;
+    auto& d = group->getDict();
+    auto it = d.find(name);
+    return it == d.end() || it->second->getDtype() == json::dtype::lnull ? nullptr : it->second;
+}
+
+std::string entryhash(const pjson& group, const std::string& name) { // empty if the group has no such file
+    auto entry = groupentry(group, name);
+    return entry ? entry->getList()[0]->getString() : "";
+}
+
+pjson snapshotgroup(const pjson& snapshot, const std::string& section, const std::string& module = "") { // files of a module, or the state files; null if absent
+    if (!snapshot) return nullptr;
+    auto& d = snapshot->getDict();
+    auto it = d.find(section);
+    if (it == d.end()) return nullptr;
+    if (module.empty()) return it->second;
+    auto m = it->second->getDict().find(module);
+    return m == it->second->getDict().end() ? nullptr : m->second;
+}
+
+struct snapshotter {
+    std::string proot;
+    pjson last; // the newest snapshot in full, which the next one records its changes against
+    int64_t nextid = 1;
+    long sincebase = 0; // deltas saved since the last base
+    bool walk = true; // the next snapshot walks the whole graph and is saved as a base
+    std::set<std::pair<std::string, std::string>> changed; // (module, file) since the last snapshot; an empty file stands for all of the module's
+};
+
+snapshotter snapshots;
+
+void snapshotchanged(const std::string& module, const std::string& file) { // file may have changed; empty for any file of module
+    snapshots.changed.emplace(module, file);
+}
+
+void pin(const std::string& path, const std::string& name) { // throws if it can't be pinned
+    auto pin = snapshotdir(snapshots.proot) + "pins/" + name;
+    if (::link(path.c_str(), pin.c_str()) != 0 && errno != EEXIST)
+        throw std::runtime_error("[Errno " + std::to_string(errno) + "] " + std::strerror(errno) + ": '" + pin + "'");
+}
+
+pjson makeentry(const std::string& id, const std::string& key) {
+    auto entry = json::makeList();
+    entry->getList().push_back(json::makeString(id));
+    entry->getList().push_back(json::makeString(key));
+    return entry;
+}
+
+bool samecontent(const std::string& key, const std::string& now) { // by size and mtime, which a copy that keeps its mtime (fsop.unshare()) doesn't change
+    auto from = [](const std::string& k) { auto p = k.find(':', k.find(':') + 1); return p == std::string::npos ? k : k.substr(p + 1); };
+    return from(key) == from(now);
+}
+
+pjson capture(const std::string& store, const std::string& path, const pjson& before, size_t& read) { // a state file's [hash, key], or null if it doesn't exist; throws if its blob can't be pinned
+
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+    auto key = sourcekey(st);
+    if (before && before->getList()[1]->getString() == key) return before;
+
+    auto hash = storefile(store, path);
+    if (hash.empty()) return nullptr;
+    read++;
+    pin(blobpath(store, hash), hash);
+    return makeentry(hash, key);
+
+}
+
+pjson capturefile(const std::string& store, const std::string& module, const std::string& file, const pjson& before, size_t& read) { // a module file's [id, key], or null if it doesn't exist; throws if it can't be pinned
+
+    auto& proot = snapshots.proot;
+    auto path = modulepath(proot, module, file);
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+    auto key = sourcekey(st);
+
+    auto hash = storedhash(proot, module, file); // a link to its blob, so there is nothing to read
+    if (!hash.empty()) {
+        if (before && before->getList()[0]->getString() == hash) return before;
+        pin(blobpath(store, hash), hash);
+        return makeentry(hash, key);
+    }
+    if (before && samecontent(before->getList()[1]->getString(), key)) return before;
+
+    if (storeimportedkey(proot, module, file) == key) { // the copy create made, untouched: its inode is pinned as it is, unread
+        auto id = "i" + std::to_string(st.st_dev) + "-" + std::to_string(st.st_ino);
+        pin(path, id);
+        return makeentry(id, key);
+    }
+
+    hash = storefile(store, path);
+    if (hash.empty()) return nullptr;
+    read++;
+    pin(blobpath(store, hash), hash);
+    // the file becomes a link to the blob, as if storeput() had written it, so its content isn't kept twice
+    if (storerestore(proot, module, file, hash) && ::stat(path.c_str(), &st) == 0) key = sourcekey(st);
+    return makeentry(hash, key);
+
+}
+
+void prunesnapshots(const std::string& proot, size_t keep) { // drops the oldest snapshots and unpins what only they used
+
+    auto ids = snapshotids(proot);
+    if (ids.size() <= keep + keep / 4) return; // in batches, since unpinning reads the snapshots that are kept
+
+    // the oldest snapshot kept, and every delta after it, build on the base at or before it
+    size_t first = ids.size() - keep;
+    std::vector<pjson> kept;
+    for (;;) {
+        kept.push_back(readsnapshot(proot, ids[first]));
+        if (!isdelta(kept.back()) || first == 0) break;
+        first--;
+    }
+    for (size_t i = first + kept.size(); i < ids.size(); i++) kept.push_back(readsnapshot(proot, ids[i]));
+    for (size_t i = 0; i < first; i++) std::remove((snapshotdir(proot) + std::to_string(ids[i]) + ".json").c_str());
+
+    std::set<std::string> used;
+    auto use = [&used](const pjson& group) {
+        for (const auto& f : group->getDict())
+            if (f.second->getDtype() != json::dtype::lnull) used.insert(f.second->getList()[0]->getString());
+    };
+    for (const auto& snapshot : kept) {
+        for (const auto& m : snapshot->getDict()["files"]->getDict()) use(m.second);
+        use(snapshot->getDict()["state"]);
+    }
+
+    auto pins = snapshotdir(proot) + "pins/";
+    DIR* dp = ::opendir(pins.c_str());
+    if (!dp) return;
+    struct dirent* entry;
+    while ((entry = ::readdir(dp)) != nullptr)
+        if (entry->d_type == DT_REG && !used.count(entry->d_name)) ::unlinkat(::dirfd(dp), entry->d_name, 0);
+    ::closedir(dp);
+
+}
+
+pjson takesnapshot(const std::string& proot, pjson dgraph, const std::string& where) { // returns the newest snapshot in full; null if the project doesn't keep them or this one failed
+
+    long keep = envint("HLL_SNAPSHOTS", 100);
+    auto store = storedir(proot);
+    if (keep <= 0 || store.empty()) return nullptr;
+
+    if (snapshots.proot != proot) {
+        snapshots = snapshotter();
+        snapshots.proot = proot;
+        auto ids = snapshotids(proot);
+        if (!ids.empty()) {
+            snapshots.nextid = ids.back() + 1;
+            try { snapshots.last = loadsnapshot(proot, ids.back()); }
+            catch (...) { }
+        }
+    }
+    ::mkdir(snapshotdir(proot).c_str(), 0755);
+    ::mkdir((snapshotdir(proot) + "pins").c_str(), 0755);
+
+    bool base = snapshots.walk || !snapshots.last || snapshots.sincebase + 1 >= envint("HLL_SNAPSHOT_BASE", 25);
+    auto snapshot = json::makeDict(); // what is saved: every entry for a base, the ones that changed for a delta
+    auto& sd = snapshot->getDict();
+    sd["id"] = json::makeInt(snapshots.nextid);
+    sd["time"] = json::makeInt(std::time(nullptr));
+    sd["where"] = json::makeString(where);
+    sd["files"] = json::makeDict();
+    sd["state"] = json::makeDict();
+
+    size_t read = 0, changes = 0;
+    auto record = [&](pjson group, const pjson& previous, const std::string& module, const std::string& name) { // a state file without a module
+        auto before = groupentry(previous, name);
+        auto entry = module.empty() ? capture(store, proot + hll_metadata_subdir + name, before, read) : capturefile(store, module, name, before, read);
+        if (entry != before || base) group->getDict()[name] = entry ? entry : json::makeNull();
+        if ((entry ? entry->getList()[0]->getString() : "") != (before ? before->getList()[0]->getString() : "")) changes++;
+    };
+    auto filesof = [&sd](const std::string& module) {
+        auto& files = sd["files"]->getDict();
+        if (!files.count(module)) files[module] = json::makeDict();
+        return files[module];
+    };
+
+    try {
+
+        auto& graphfiles = dgraph->getDict()["files"]->getDict();
+        if (base) {
+            for (const auto& m : graphfiles) {
+                auto group = filesof(m.first);
+                for (const auto& f : m.second->getList()) {
+                    auto name = f->getString();
+                    record(group, snapshotgroup(snapshots.last, "files", m.first), m.first, name);
+                }
+                for (auto it = group->getDict().begin(); it != group->getDict().end();) { // a base only lists files that exist
+                    if (it->second->getDtype() == json::dtype::lnull) it = group->getDict().erase(it);
+                    else it++;
+                }
+            }
+        }
+        else {
+            std::set<std::pair<std::string, std::string>> files;
+            for (const auto& c : snapshots.changed) {
+                if (!c.second.empty()) { files.insert(c); continue; }
+                auto m = graphfiles.find(c.first);
+                if (m != graphfiles.end()) for (const auto& f : m->second->getList()) files.emplace(c.first, f->getString());
+                if (auto previous = snapshotgroup(snapshots.last, "files", c.first))
+                    for (const auto& f : previous->getDict()) files.emplace(c.first, f.first);
+            }
+            for (const auto& f : files) {
+                auto previous = snapshotgroup(snapshots.last, "files", f.first);
+                auto group = filesof(f.first);
+                record(group, previous, f.first, f.second);
+                if (group->getDict().empty()) sd["files"]->getDict().erase(f.first);
+            }
+        }
+
+        auto previous = snapshotgroup(snapshots.last, "state");
+        std::set<std::string> names;
+        for (const auto& name : statefiles(proot)) names.insert(name);
+        if (previous) for (const auto& f : previous->getDict()) names.insert(f.first);
+        for (const auto& name : names) record(sd["state"], previous, "", name);
+        if (base) {
+            for (auto it = sd["state"]->getDict().begin(); it != sd["state"]->getDict().end();) {
+                if (it->second->getDtype() == json::dtype::lnull) it = sd["state"]->getDict().erase(it);
+                else it++;
+            }
+        }
+
+        savestore(); // files capturefile() linked to their blobs
+
+        if (snapshots.last && changes == 0) { // nothing to roll back to that the last one doesn't have
+            snapshots.walk = false;
+            snapshots.changed.clear();
+            metricadd("snapshots.skipped");
+            metricadd("snapshots.files_read", read);
+            return snapshots.last;
+        }
+
+        if (!base) sd["parent"] = snapshots.last->getDict()["id"];
+        snapshot->save(snapshotdir(proot) + std::to_string(snapshots.nextid) + ".json", true);
+
+    }
+    catch (const std::exception&) { // the changes stay queued for the next snapshot
+        metricadd("snapshots.failed");
+        return nullptr;
+    }
+
+    if (base) {
+        snapshots.last = snapshot;
+        snapshots.sincebase = 0;
+    }
+    else {
+        applydelta(snapshots.last, snapshot);
+        snapshots.sincebase++;
+    }
+    snapshots.nextid++;
+    snapshots.walk = false;
+    snapshots.changed.clear();
+    prunesnapshots(proot, keep);
+    metricadd(base ? "snapshots.bases" : "snapshots.deltas");
+    metricadd("snapshots.taken");
+    metricadd("snapshots.files_read", read);
+    return snapshots.last;
+
+}
+
+std::string snapshottime(const pjson& snapshot) {
+    std::time_t t = snapshot->getDict()["time"]->getInt();
+    char out[32];
+    std::strftime(out, sizeof(out), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+    return out;
+}
+
+struct snapshotdiff {
+    std::vector<std::string> added, removed, changed; // module/file
+};
+
+snapshotdiff diffsnapshots(const pjson& a, const pjson& b) {
+    snapshotdiff d;
+    auto& am = a->getDict()["files"]->getDict();
+    auto& bm = b->getDict()["files"]->getDict();
+    for (const auto& m : bm)
+        for (const auto& f : m.second->getDict()) {
+            auto before = entryhash(snapshotgroup(a, "files", m.first), f.first);
+            if (before.empty()) d.added.push_back(m.first + "/" + f.first);
+            else if (before != f.second->getList()[0]->getString()) d.changed.push_back(m.first + "/" + f.first);
+        }
+    for (const auto& m : am)
+        for (const auto& f : m.second->getDict())
+            if (entryhash(snapshotgroup(b, "files", m.first), f.first).empty()) d.removed.push_back(m.first + "/" + f.first);
+    return d;
+}
+
+void listsnapshots(const std::string& proot) {
+
+    auto ids = snapshotids(proot);
+    if (ids.empty()) {
+        std::cout << "There are no snapshots\n";
+        return;
+    }
+
+    pjson current; // the snapshot listed last, in full
+    for (auto id : ids) {
+        auto saved = readsnapshot(proot, id);
+        size_t n = 0;
+        if (current && isdelta(saved) && saved->getDict()["parent"]->getInt() == current->getDict()["id"]->getInt()) {
+            for (const auto& m : saved->getDict()["files"]->getDict()) // the delta lists the files that changed, and some whose content didn't
+                for (const auto& f : m.second->getDict()) {
+                    auto after = f.second->getDtype() == json::dtype::lnull ? "" : f.second->getList()[0]->getString();
+                    if (after != entryhash(snapshotgroup(current, "files", m.first), f.first)) n++;
+                }
+            applydelta(current, saved);
+        }
+        else {
+            auto snapshot = isdelta(saved) ? loadsnapshot(proot, id) : saved;
+            if (current) {
+                auto d = diffsnapshots(current, snapshot);
+                n = d.added.size() + d.removed.size() + d.changed.size();
+            }
+            current = snapshot;
+        }
+        std::cout << id << " : " << snapshottime(current) << " : " << current->getDict()["where"]->getString();
+        if (n) std::cout << " (" << n << " file" << (n == 1 ? "" : "s") << " changed)";
+        std::cout << "\n";
+    }
+
+}
+
+void printsnapshotdiff(const std::string& proot, int64_t a, int64_t b) {
+
+    auto d = diffsnapshots(loadsnapshot(proot, a), loadsnapshot(proot, b));
+    if (d.added.empty() && d.removed.empty() && d.changed.empty()) {
+        std::cout << "No files differ between snapshots " << a << " and " << b << "\n";
+        return;
+    }
+    for (const auto& f : d.added) std::cout << "+ " << f << "\n";
+    for (const auto& f : d.removed) std::cout << "- " << f << "\n";
+    for (const auto& f : d.changed) std::cout << "M " << f << "\n";
+
+}
+
+void restoresnapshot(const std::string& proot, int64_t id) { // makes the project what it was at snapshot id, so `resume` continues from there
+
+    auto target = loadsnapshot(proot, id);
+    auto store = storedir(proot);
+    if (store.empty()) throw std::runtime_error("Project has no content store, so it can't be restored");
+    if (envint("HLL_SNAPSHOTS", 100) <= 0) throw std::runtime_error("Snapshots are disabled (HLL_SNAPSHOTS=0)");
+
+    auto dgraph = json::loadFromFile(proot + hll_metadata_subdir + "dependency_graph.json");
+    auto current = takesnapshot(proot, dgraph, "before resuming from snapshot " + std::to_string(id));
+    if (!current) throw std::runtime_error("Failed to snapshot the project as it is, so it wasn't rolled back");
+
+    size_t restored = 0, removed = 0;
+    for (const auto& m : target->getDict()["files"]->getDict())
+        for (const auto& f : m.second->getDict()) {
+            auto hash = f.second->getList()[0]->getString();
+            if (entryhash(snapshotgroup(current, "files", m.first), f.first) == hash) continue;
+            bool pinned = hash[0] == 'i'; // a file create copied, pinned as it was; see capturefile()
+            if (!(pinned ? storerestorepinned(proot, m.first, f.first, snapshotdir(proot) + "pins/" + hash) : storerestore(proot, m.first, f.first, hash)))
+                throw std::runtime_error("Failed to restore " + m.first + "/" + f.first + " from snapshot " + std::to_string(id));
+            restored++;
+        }
+    for (const auto& m : current->getDict()["files"]->getDict()) {
+        for (const auto& f : m.second->getDict())
+            if (entryhash(snapshotgroup(target, "files", m.first), f.first).empty() && std::remove(modulepath(proot, m.first, f.first).c_str()) == 0) removed++;
+        if (m.first != "global" && !snapshotgroup(target, "files", m.first)) ::rmdir((proot + m.first).c_str()); // only if it's empty now
+    }
+
+    for (const auto& name : statefiles(proot)) std::remove((proot + hll_metadata_subdir + name).c_str());
+    for (const auto& f : target->getDict()["state"]->getDict()) // copied, not linked: state files are rewritten in place
+        if (copyfile(blobpath(store, f.second->getList()[0]->getString()), proot + hll_metadata_subdir + f.first) < 0)
+            throw std::runtime_error("Failed to restore " + f.first + " from snapshot " + std::to_string(id));
+
+    // a new identity, so the action server doesn't take the restored graph for the one it has at the same version
+    auto graph = json::loadFromFile(proot + hll_metadata_subdir + "dependency_graph.json");
+    graph->getDict()["id"] = json::makeString(newgraphid(proot));
+    graph->getDict()["version"] = json::makeInt(0);
+    graph->save(proot + hll_metadata_subdir + "dependency_graph.json", true);
+    savestore();
+    snapshots.proot.clear(); // the files aren't what the last snapshot says anymore, so the next one walks the graph again
+
+    std::cout << "Restored snapshot " << id << " (" << snapshottime(target) << "): " << restored << " file" << (restored == 1 ? "" : "s")
+        << " restored, " << removed << " removed. The project's previous state is snapshot " << current->getDict()["id"]->getInt() << ".\n";
+
+}
@@ -0,0 +1,603 @@
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include "defs.hpp"
+#include "json.hpp"
+#include "metrics.hpp"
+
+/*
+content-addressed file store
+
+the files of a project are hard links to blobs named by the SHA-256 of their content. the store is shared by every
+project created from the same root directory (<root>/hll/.blobs/), so projects created from the same sources, and files
+with the same content in different modules, take up disk space once. a blob's link count is its reference count: the
+filesystem keeps it, even across crashes, and a blob whose only link is its own is garbage that storegc() removes.
+
+each project's manifest (.hll/manifest.json) names its store and maps module -> file -> hash for the files that are links
+into it. an entry only counts while the file still has the blob's inode, so a file replaced behind our back (by a plugin,
+or by hand) simply drops out. writing a file through storeput() costs nothing if the file already has that content,
+and otherwise links it to the blob for its content, creating the blob if this is the first copy. appends and edits
+change a file in place, so they call storeunshare() first, which gives a linked file a private copy; the server's
+fsop.py does the same before it writes, and gives every file a plugin's module may write its own copy before the plugin
+runs. blobs are also read-only, which makes a stray in-place write fail where permissions are enforced (not for root).
+
+creating a project imports the root directory with storeimportfiles(), on HLL_CREATE_THREADS workers. by default each
+source is copied straight into the project with copycontents(), which reflinks (FICLONE) where the filesystem can, lets
+copy_file_range() copy inside the kernel otherwise, and only then copies through a buffer; nothing is hashed, so create
+costs no more than the copy. such files are outside the store until they are first written through storeput(), or until
+a snapshot finds them changed and links them to a blob (see snapshot.cpp); the manifest's "imported" section keeps the
+sourcekey() of each copy, so snapshots can tell the ones nobody touched without reading them. with HLL_CREATE_DEDUP=1
+create links every file into the store instead: a source is hashed by streaming it, and not at all if its device, inode,
+size and mtime match the last import (the store's sources.json), and a blob that is missing is made with copycontents().
+a project created that way from sources already in the store is a directory of hard links, whatever their size, which
+saves the space a copy takes on filesystems without reflinks, but the first import reads every byte.
+
+projects without a manifest (created before the store existed) are written to directly, as always. if the filesystem
+refuses the hard link, files are copied instead and left out of the manifest.
+*/
+
+// SHA-256 (FIPS 180-4)
+
+struct sha256 {
+
+    uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    unsigned char block[64];
+    size_t used = 0;
+    uint64_t length = 0;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const unsigned char* p) {
+
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+
+    }
+
+    void update(const char* data, size_t n) {
+        length += n;
+        while (n > 0) {
+            size_t take = std::min(n, 64 - used);
+            std::memcpy(block + used, data, take);
+            used += take; data += take; n -= take;
+            if (used == 64) { compress(block); used = 0; }
+        }
+    }
+
+    std::string hex() { // finishes the digest
+        uint64_t bits = length * 8;
+        unsigned char pad = 0x80;
+        update((const char*)&pad, 1);
+        pad = 0;
+        while (used != 56) update((const char*)&pad, 1);
+        for (int i = 7; i >= 0; i--) { unsigned char b = bits >> (8 * i); update((const char*)&b, 1); }
+        char out[65];
+        for (int i = 0; i < 8; i++) std::snprintf(out + 8 * i, 9, "%08x", h[i]);
+        return std::string(out, 64);
+    }
+
+};
+
+std::string sha256hex(const std::string& data) {
+    sha256 s;
+    s.update(data.data(), data.size());
+    return s.hex();
+}
+
+// manifests
+
+struct projectstore {
+    std::string proot;
+    std::string dir; // the store; empty if the project doesn't use one
+    pjson manifest; // { store, modules: { module: { file: hash } }, imported: { module: { file: sourcekey } } }
+    bool dirty = false;
+};
+
+projectstore currentstore;
+
+void savestore();
+
+std::string manifestpath(const std::string& proot) { return proot + hll_metadata_subdir + "manifest.json"; }
+
+projectstore& storeof(const std::string& proot) { // the project's manifest, loaded once
+
+    if (currentstore.manifest && currentstore.proot == proot) return currentstore;
+
+    savestore();
+    currentstore = projectstore();
+    currentstore.proot = proot;
+    try {
+        currentstore.manifest = json::loadFromFile(manifestpath(proot));
+        currentstore.dir = currentstore.manifest->getDict().at("store")->getString();
+        currentstore.manifest->getDict().at("modules")->getDict();
+    }
+    catch (...) {
+        currentstore.manifest = json::makeDict();
+        currentstore.dir.clear();
+    }
+    return currentstore;
+
+}
+
+void savestore() { // called at checkpoints; entries lost to a crash only cost deduplication, since entries are checked against inodes
+    if (!currentstore.dirty || currentstore.dir.empty()) return;
+    currentstore.manifest->save(manifestpath(currentstore.proot), true);
+    currentstore.dirty = false;
+}
+
+std::string blobpath(const std::string& dir, const std::string& hash) { return dir + hash.substr(0, 2) + "/" + hash.substr(2); }
+
+std::string modulepath(const std::string& proot, const std::string& module, const std::string& file) {
+    return module == "global" ? proot + file : proot + module + "/" + file;
+}
+
+pjson manifestentries(projectstore& s, const std::string& module) {
+    auto& modules = s.manifest->getDict()["modules"]->getDict();
+    auto it = modules.find(module);
+    if (it != modules.end()) return it->second;
+    return modules[module] = json::makeDict();
+}
+
+void forget(projectstore& s, const std::string& module, const std::string& file) {
+    auto& entries = manifestentries(s, module)->getDict();
+    if (entries.erase(file)) s.dirty = true;
+}
+
+bool sameinode(const std::string& a, const std::string& b) {
+    struct stat sa, sb;
+    return ::stat(a.c_str(), &sa) == 0 && ::stat(b.c_str(), &sb) == 0 && sa.st_ino == sb.st_ino && sa.st_dev == sb.st_dev;
+}
+
+// blobs
+
+std::string tempname(const std::string& near) {
+    static std::atomic<unsigned> counter{ 0 }; // imports name temp files from several threads
+    return near + ".hll-tmp-" + std::to_string(::getpid()) + "-" + std::to_string(counter++);
+}
+
+bool writeall(int fd, const char* data, size_t n) {
+    while (n > 0) {
+        ssize_t w = ::write(fd, data, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        data += w; n -= w;
+    }
+    return true;
+}
+
+// copying
+
+struct fdcloser { // as in actions.cpp
+    int fd;
+    ~fdcloser() { if (fd >= 0) ::close(fd); }
+};
+
+int copycontents(int in, int out, off_t size) { // 0: reflinked, 1: copied by the kernel, 2: copied through a buffer, -1: failed
+
+#ifdef FICLONE
+    if (::ioctl(out, FICLONE, in) == 0) return 0; // btrfs, xfs, bcachefs: shares the extents, whatever the size
+#endif
+
+    off_t done = 0;
+    while (done < size) { // copy_file_range may still reflink (nfs, cifs) or at least copy without leaving the kernel
+        ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, size - done, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0) { done += n; continue; }
+        if (n == 0 && done > 0) break; // it shrank
+        if (done == 0 && (n == 0 || errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF)) break;
+        return -1;
+    }
+    if (done > 0) return 1;
+
+    std::vector<char> buffer(1 << 20);
+    for (;;) {
+        ssize_t r = ::read(in, buffer.data(), buffer.size());
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) return 2;
+        if (!writeall(out, buffer.data(), r)) return -1;
+    }
+
+}
+
+int copyfile(const std::string& src, const std::string& dst) { // replaces dst with a writable copy of src, reflinked if the filesystem can; a copycontents() result
+
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return -1;
+    fdcloser closein{ in };
+    struct stat st;
+    if (::fstat(in, &st) != 0) return -1;
+
+    auto tmp = tempname(dst);
+    int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, (st.st_mode & 07777) | S_IWUSR); // src may be a read-only blob
+    if (out < 0) return -1;
+    int method = copycontents(in, out, st.st_size);
+    ::close(out);
+    if (method < 0 || ::rename(tmp.c_str(), dst.c_str()) != 0) { ::unlink(tmp.c_str()); return -1; }
+    return method;
+
+}
+
+bool putblob(const std::string& dir, const std::string& hash, const std::string& content) { // false if the store can't be written
+
+    auto path = blobpath(dir, hash);
+    if (::access(path.c_str(), F_OK) == 0) return true;
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir + hash.substr(0, 2), ec);
+    auto tmp = tempname(path);
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444); // read-only, so writing through a link fails instead of changing every copy
+    if (fd < 0) return false;
+    bool ok = writeall(fd, content.data(), content.size());
+    ::close(fd);
+    bool published = ok && (::link(tmp.c_str(), path.c_str()) == 0 || errno == EEXIST); // never replaces a blob that has links
+    ::unlink(tmp.c_str());
+    if (!published) return false;
+
+    metricadd("store.blobs_created");
+    return true;
+
+}
+
+bool linkfile(const std::string& src, const std::string& path) { // atomically replaces path with a link to src
+    auto tmp = tempname(path);
+    if (::link(src.c_str(), tmp.c_str()) != 0) return false;
+    if (::rename(tmp.c_str(), path.c_str()) != 0) { ::unlink(tmp.c_str()); return false; }
+    return true;
+}
+
+bool linkblob(const std::string& dir, const std::string& hash, const std::string& path) { // atomically replaces path with a link to the blob
+    return linkfile(blobpath(dir, hash), path);
+}
+
+bool storeput(const std::string& proot, const std::string& module, const std::string& file, const std::string& content) { // false if the project has no store or the link failed; the caller then writes the file itself
+
+    auto& s = storeof(proot);
+    if (s.dir.empty()) return false;
+
+    auto path = modulepath(proot, module, file);
+    auto hash = sha256hex(content);
+    auto& entries = manifestentries(s, module)->getDict();
+
+    auto known = entries.find(file);
+    if (known != entries.end() && known->second->getString() == hash && sameinode(path, blobpath(s.dir, hash))) {
+        metricadd("store.unchanged_writes");
+        return true;
+    }
+
+    bool existed = ::access(blobpath(s.dir, hash).c_str(), F_OK) == 0;
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    if (!putblob(s.dir, hash, content) || !linkblob(s.dir, hash, path)) {
+        forget(s, module, file);
+        return false;
+    }
+
+    if (existed) metricadd("store.bytes_deduplicated", content.size());
+    entries[file] = json::makeString(hash);
+    s.dirty = true;
+    return true;
+
+}
+
+void storeunshare(const std::string& proot, const std::string& module, const std::string& file, bool keepcontent) { // gives the file a private inode before it is changed in place; without keepcontent the link is just removed
+
+    auto& s = storeof(proot);
+    if (s.dir.empty()) return;
+    forget(s, module, file);
+
+    auto path = modulepath(proot, module, file);
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || st.st_nlink < 2) return;
+
+    if (!keepcontent) { // about to be truncated, so there is nothing to copy
+        if (::unlink(path.c_str()) != 0 && errno != ENOENT)
+            throw std::runtime_error("[Errno " + std::to_string(errno) + "] " + std::strerror(errno) + ": '" + path + "'");
+        metricadd("store.unshared");
+        return;
+    }
+    if (copyfile(path, path) < 0) // a reflink where the filesystem has them, so unsharing a large file is cheap too
+        throw std::runtime_error("[Errno " + std::to_string(errno) + "] " + std::strerror(errno) + ": '" + path + "'");
+    metricadd("store.unshared");
+
+}
+
+// importing
+
+struct importedfile {
+    std::string hash;
+    off_t size = 0;
+    int method = -1; // how the blob (or the copy) was made: -1 it already existed, otherwise a copycontents() result
+    bool linked = false;
+    bool copied = false; // straight into the project, outside the store
+};
+
+std::string sourcekey(const struct stat& st) { // changes whenever the file could have
+    return std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":"
+        + std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+}
+
+bool hashfd(int fd, std::string& hash) {
+    sha256 s;
+    std::vector<char> buffer(1 << 20);
+    for (;;) {
+        ssize_t r = ::read(fd, buffer.data(), buffer.size());
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return false;
+        if (r == 0) break;
+        s.update(buffer.data(), r);
+    }
+    hash = s.hex();
+    return ::lseek(fd, 0, SEEK_SET) == 0;
+}
+
+bool makeblob(const std::string& dir, int in, off_t size, const std::string& hash, int& method) { // copies in (at offset 0) to the blob for hash unless it exists; method: -1 if it did, else a copycontents() result
+
+    method = -1;
+    auto blob = blobpath(dir, hash);
+    if (::access(blob.c_str(), F_OK) == 0) return true;
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir + hash.substr(0, 2), ec);
+    auto tmp = tempname(blob);
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444); // read-only, so writing through a link fails instead of changing every copy
+    if (fd < 0) return false;
+    int copied = copycontents(in, fd, size);
+    ::close(fd);
+    // link() rather than rename(), so a blob another worker published meanwhile is kept, not replaced under its links
+    bool published = copied >= 0 && (::link(tmp.c_str(), blob.c_str()) == 0 || errno == EEXIST);
+    ::unlink(tmp.c_str());
+    if (published) method = copied;
+    return published;
+
+}
+
+typedef std::unordered_map<std::string, std::pair<std::string, std::string>> sourcehashes; // source path -> (sourcekey, hash)
+
+void importone(const std::string& dir, const std::string& src, const std::string& dst, const sourcehashes& known, importedfile& out) { // runs on a worker; without a store dir, only copies
+
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return;
+    fdcloser closein{ in };
+    struct stat st;
+    if (::fstat(in, &st) != 0) return;
+    out.size = st.st_size;
+
+    if (dir.empty()) {
+        out.method = copyfile(src, dst);
+        out.copied = out.method >= 0;
+        return;
+    }
+
+    auto cached = known.find(src);
+    if (cached != known.end() && cached->second.first == sourcekey(st)) out.hash = cached->second.second;
+    else if (!hashfd(in, out.hash)) return;
+
+    if (!makeblob(dir, in, st.st_size, out.hash, out.method)) return;
+    out.linked = linkblob(dir, out.hash, dst);
+
+}
+
+std::string storefile(const std::string& dir, const std::string& path) { // the file's hash, once the store holds a copy of it; empty if it can't be read
+    int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return "";
+    fdcloser closein{ in };
+    struct stat st;
+    std::string hash;
+    int method;
+    if (::fstat(in, &st) != 0 || !hashfd(in, hash) || !makeblob(dir, in, st.st_size, hash, method)) return "";
+    return hash;
+}
+
+bool storerestore(const std::string& proot, const std::string& module, const std::string& file, const std::string& hash) { // puts a stored version back as the file; false if the store doesn't have it
+
+    auto& s = storeof(proot);
+    if (s.dir.empty()) return false;
+    auto path = modulepath(proot, module, file);
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    if (!linkblob(s.dir, hash, path)) {
+        forget(s, module, file);
+        return false;
+    }
+    manifestentries(s, module)->getDict()[file] = json::makeString(hash);
+    s.dirty = true;
+    return true;
+
+}
+
+pjson storeimportfiles(const std::string& proot, const std::string& module, const std::vector<std::pair<std::string, std::string>>& files) { // (source, name) pairs into the module through the store; returns what it cost
+
+    auto& s = storeof(proot);
+    auto started = std::chrono::steady_clock::now();
+    std::vector<importedfile> results(files.size());
+
+    bool dedup = !s.dir.empty() && envint("HLL_CREATE_DEDUP", 0) > 0; // otherwise files are copied, and stored when first written or snapshotted
+    auto sourcesfile = s.dir + "sources.json"; // source path -> [ key, hash ], so unchanged sources aren't hashed again
+    sourcehashes known;
+    if (dedup) {
+        try {
+            auto saved = json::loadFromFile(sourcesfile);
+            for (const auto& kv : saved->getDict())
+                known[kv.first] = { kv.second->getList().at(0)->getString(), kv.second->getList().at(1)->getString() };
+        }
+        catch (...) { known.clear(); }
+    }
+
+    {
+        size_t threads = std::clamp<size_t>(envint("HLL_CREATE_THREADS", std::min(16u, std::max(1u, std::thread::hardware_concurrency()))), 1, 64);
+        std::atomic<size_t> next{ 0 };
+        auto worker = [&]() {
+            for (size_t i; (i = next++) < files.size();)
+                importone(dedup ? s.dir : "", files[i].first, modulepath(proot, module, files[i].second), known, results[i]);
+        };
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < std::min(threads, files.size()); t++) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+    }
+
+    auto report = json::makeDict();
+    size_t bytes = 0, stored = 0, cloned = 0, copied = 0;
+    auto& entries = manifestentries(s, module)->getDict();
+    pjson imported; // the copies, by the sourcekey() they have now, so snapshots can tell they are untouched without reading them
+    if (!s.dir.empty()) {
+        auto& d = s.manifest->getDict();
+        if (!d.count("imported")) d["imported"] = json::makeDict();
+        auto& modules = d["imported"]->getDict();
+        if (!modules.count(module)) modules[module] = json::makeDict();
+        imported = modules[module];
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        auto& r = results[i];
+        if (r.linked) {
+            entries[files[i].second] = json::makeString(r.hash);
+            s.dirty = true;
+            struct stat st;
+            if (::stat(files[i].first.c_str(), &st) == 0) known[files[i].first] = { sourcekey(st), r.hash };
+        }
+        else if (!r.copied) { // the filesystem refused the link, or the copy failed on a worker: a plain copy outside the manifest
+            int method = copyfile(files[i].first, modulepath(proot, module, files[i].second));
+            if (method < 0) continue;
+            r.method = method;
+            r.copied = true;
+        }
+        struct stat st;
+        if (r.copied && imported && ::stat(modulepath(proot, module, files[i].second).c_str(), &st) == 0) {
+            imported->getDict()[files[i].second] = json::makeString(sourcekey(st));
+            s.dirty = true;
+        }
+        bytes += r.size;
+        if (r.method < 0) stored += r.size;
+        else if (r.method == 0) cloned += r.size;
+        else copied += r.size;
+    }
+
+    if (dedup) {
+        auto sources = json::makeDict();
+        for (const auto& kv : known) { // sources whose blob was collected are dropped
+            if (::access(blobpath(s.dir, kv.second.second).c_str(), F_OK) != 0) continue;
+            auto entry = json::makeList();
+            entry->getList().push_back(json::makeString(kv.second.first));
+            entry->getList().push_back(json::makeString(kv.second.second));
+            sources->getDict()[kv.first] = entry;
+        }
+        try { sources->save(sourcesfile, true); } catch (...) { } // only a cache
+    }
+
+    metricadd("store.bytes_deduplicated", stored);
+    metricadd("store.bytes_reflinked", cloned);
+    metricadd("store.bytes_copied", copied);
+    report->getDict()["files"] = json::makeInt(files.size());
+    report->getDict()["bytes"] = json::makeInt(bytes);
+    report->getDict()["stored"] = json::makeInt(stored);
+    report->getDict()["cloned"] = json::makeInt(cloned);
+    report->getDict()["copied"] = json::makeInt(copied);
+    report->getDict()["ms"] = json::makeInt(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count());
+    return report;
+
+}
+
+std::string storedhash(const std::string& proot, const std::string& module, const std::string& file) { // the file's hash if it is still a link to that blob; empty otherwise
+    auto& s = storeof(proot);
+    if (s.dir.empty()) return "";
+    auto& entries = manifestentries(s, module)->getDict();
+    auto it = entries.find(file);
+    if (it == entries.end() || !sameinode(modulepath(proot, module, file), blobpath(s.dir, it->second->getString()))) return "";
+    return it->second->getString();
+}
+
+std::string storeimportedkey(const std::string& proot, const std::string& module, const std::string& file) { // sourcekey() of the copy create made, if it was copied rather than stored; empty otherwise
+    auto& d = storeof(proot).manifest->getDict();
+    auto imported = d.find("imported");
+    if (imported == d.end()) return "";
+    auto m = imported->second->getDict().find(module);
+    if (m == imported->second->getDict().end()) return "";
+    auto f = m->second->getDict().find(file);
+    return f == m->second->getDict().end() ? "" : f->second->getString();
+}
+
+bool storerestorepinned(const std::string& proot, const std::string& module, const std::string& file, const std::string& pin) { // puts a pinned inode back as the file, outside the manifest
+    auto& s = storeof(proot);
+    auto path = modulepath(proot, module, file);
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    if (!s.dir.empty()) forget(s, module, file);
+    return linkfile(pin, path);
+}
+
+void storeinit(const std::string& proot, const std::string& dir) { // gives a new project a manifest, so its files go through the store at dir
+    savestore();
+    currentstore = projectstore();
+    currentstore.proot = proot;
+    currentstore.dir = dir;
+    currentstore.manifest = json::makeDict();
+    currentstore.manifest->getDict()["store"] = json::makeString(dir);
+    currentstore.manifest->getDict()["modules"] = json::makeDict();
+    currentstore.dirty = true;
+}
+
+std::string storedir(const std::string& proot) { // the project's store, or empty
+    return storeof(proot).dir;
+}
+
+size_t storegc(const std::string& dir) { // removes blobs no project links to, and temp files left by crashes; returns the bytes freed
+
+    size_t freed = 0;
+    auto now = std::chrono::system_clock::now();
+    std::error_code ec;
+
+    for (const auto& sub : std::filesystem::directory_iterator(dir, ec)) {
+        if (!sub.is_directory(ec)) continue;
+        for (const auto& blob : std::filesystem::directory_iterator(sub.path(), ec)) {
+            struct stat st;
+            if (::lstat(blob.path().c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            bool temp = blob.path().filename().string().find(".hll-tmp-") != std::string::npos;
+            bool stale = now - std::chrono::system_clock::from_time_t(st.st_mtime) > std::chrono::hours(1);
+            // a blob has a single link for a moment after it is published; if it is collected then, linking the file to it
+            // fails, and storeput() and imports fall back to writing the file themselves
+            if ((temp && stale) || (!temp && st.st_nlink == 1)) {
+                if (::unlink(blob.path().c_str()) == 0) freed += st.st_size;
+            }
+        }
+        ::rmdir(sub.path().c_str()); // only succeeds once it's empty
+    }
+
+    return freed;
+
+}
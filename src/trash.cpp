@@ -0,0 +1,159 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "defs.hpp"
+
+/*
+deleting project directories
+
+removetree() deletes a directory tree without a shell: HLL_DELETE_THREADS workers take directories off a shared queue,
+unlink the files in each with unlinkat() against the directory's own descriptor (opened O_NOFOLLOW, so a symlink is
+removed, never followed), and queue the subdirectories they find. once every directory is empty they are removed
+deepest first. projects with hundreds of thousands of files are mostly unlink() calls, which this spreads over as
+many directories as there are workers.
+
+removelater() makes `hll delete` return at once: it renames the project into .trash/ next to it (a rename on the same
+filesystem, so it's instant whatever the size) and leaves the rest to a detached process, which empties .trash/,
+including anything an interrupted earlier removal left there, and then collects the blobs the project linked to. the
+project is gone from projects.json and its name is free as soon as the rename succeeds.
+*/
+
+extern size_t storegc(const std::string& dir); // store.cpp
+
+struct treeremoval {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<std::string> pending; // directories whose entries haven't been removed yet
+    std::vector<std::string> found; // every directory below the root, to be removed once empty
+    size_t busy = 0; // workers scanning a directory, which may queue more
+    std::atomic<bool> failed{ false };
+};
+
+void emptydirectory(treeremoval& r, const std::string& dir) { // unlinks the files in dir and queues its subdirectories
+
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) r.failed = true;
+        return;
+    }
+    DIR* dp = ::fdopendir(fd);
+    if (!dp) { ::close(fd); r.failed = true; return; }
+
+    std::vector<std::string> subdirs;
+    struct dirent* entry;
+    while ((entry = ::readdir(dp)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        bool isdir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) { // some filesystems don't fill in d_type
+            struct stat st;
+            isdir = ::fstatat(fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (isdir) subdirs.push_back(dir + "/" + name);
+        else if (::unlinkat(fd, name.c_str(), 0) != 0 && errno != ENOENT) r.failed = true;
+    }
+    ::closedir(dp);
+
+    if (subdirs.empty()) return;
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.found.insert(r.found.end(), subdirs.begin(), subdirs.end());
+    r.pending.insert(r.pending.end(), subdirs.begin(), subdirs.end());
+
+}
+
+bool removetree(const std::string& dir) { // false if anything couldn't be removed; a tree that is already gone counts as removed
+
+    treeremoval r;
+    r.pending.push_back(dir);
+
+    auto worker = [&r]() {
+        for (;;) {
+            std::string next;
+            {
+                std::unique_lock<std::mutex> guard(r.lock);
+                r.wake.wait(guard, [&r] { return !r.pending.empty() || r.busy == 0; });
+                if (r.pending.empty()) return; // nothing queued and nobody left to queue more
+                next = std::move(r.pending.back());
+                r.pending.pop_back();
+                r.busy++;
+            }
+            emptydirectory(r, next);
+            {
+                std::lock_guard<std::mutex> guard(r.lock);
+                r.busy--;
+            }
+            r.wake.notify_all();
+        }
+    };
+
+    size_t threads = std::clamp<long>(envint("HLL_DELETE_THREADS", std::min(16u, std::max(1u, std::thread::hardware_concurrency()))), 1, 64);
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    // a subdirectory's path is longer than its parent's, so this removes children first
+    std::sort(r.found.begin(), r.found.end(), [](const std::string& a, const std::string& b) { return a.size() > b.size(); });
+    r.found.push_back(dir);
+    for (const auto& d : r.found)
+        if (::rmdir(d.c_str()) != 0 && errno != ENOENT) r.failed = true;
+    return !r.failed;
+
+}
+
+void emptytrash(const std::string& trash) {
+    DIR* dp = ::opendir(trash.c_str());
+    if (!dp) return;
+    std::vector<std::string> entries;
+    struct dirent* entry;
+    while ((entry = ::readdir(dp)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") entries.push_back(trash + name);
+    }
+    ::closedir(dp);
+    for (const auto& e : entries) removetree(e);
+    ::rmdir(trash.c_str()); // fails harmlessly if another removal is still filling or emptying it
+}
+
+bool removelater(const std::string& dir, const std::string& store) { // false if dir couldn't be moved aside; the caller then removes it itself
+
+    std::string path = dir;
+    while (path.size() > 1 && path.back() == '/') path.pop_back();
+    auto slash = path.rfind('/');
+    if (slash == std::string::npos) return false;
+    std::string trash = path.substr(0, slash + 1) + ".trash/";
+
+    ::mkdir(trash.c_str(), 0755);
+    std::string target = trash + path.substr(slash + 1) + "-" + std::to_string(::getpid()) + "-" + std::to_string(::time(nullptr));
+    if (::rename(path.c_str(), target.c_str()) != 0) return false;
+
+    pid_t pid = ::fork();
+    if (pid == 0) { // detach twice, so the remover is nobody's child and outlives the terminal
+        ::setsid();
+        if (::fork() != 0) ::_exit(0);
+        int null = ::open("/dev/null", O_RDWR);
+        if (null >= 0) { ::dup2(null, 0); ::dup2(null, 1); ::dup2(null, 2); }
+        ::setpriority(PRIO_PROCESS, 0, 10); // removal shouldn't compete with runs
+        emptytrash(trash);
+        if (!store.empty()) storegc(store);
+        ::_exit(0);
+    }
+    if (pid < 0) { // no background process; finish here
+        emptytrash(trash);
+        if (!store.empty()) storegc(store);
+        return true;
+    }
+    ::waitpid(pid, nullptr, 0);
+    return true;
+
+}
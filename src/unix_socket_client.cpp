@@ -4,14 +4,41 @@
 // unix_socket_client.cpp
 //
 // Robust version that only starts the python server iff it isn't already running.
+// A server we start reports back over a pipe (HLL_READY_FD) once it is listening, so we don't poll connect() while the
+// interpreter starts up; connect() is still retried on the side, for servers that don't send the signal. Under systemd
+// socket activation (server/hll-server.socket) the socket always exists and connecting starts the server.
+// One connection is kept open for the lifetime of the process and reused by every post().
+//
+// Protocol: every message is a 4 byte big-endian length followed by a JSON payload (version 1). A new connection first
+// sends {"request": "hello", "data": {"protocol": 2}}; a server that understands version 2 agrees and from then on every
+// frame carries a 4 byte request id after the length, so several requests can be in flight on the connection and their
+// responses may come back in any order. On version 1, requests are still pipelined but answered strictly in order.
+// Servers that reject "hello" predate persistent connections and close the connection after every response, so for
+// them each request gets a connection of its own, as before.
+//
+// Version 3 adds a shared-memory side channel: a payload of at least HLL_IPC_SHM_BYTES is written to a POSIX shared
+// memory object instead of the socket, and the frame (with the top bit of its length set) carries only the reference
+// {"shm": name, "size": n}. The receiver copies the payload out and unlinks the object; a request's sender unlinks it
+// again once the response is in, in case the server never got to it.
+//
+// A server with all of its workers and queue slots taken answers {"status": "busy", "retry_after_ms": n} without
+// handling the request; post() waits that long and sends the request again. The reply is recognised by its parsed
+// `status` field, not by how the server happened to format it.
 
 #include "server.hpp"
 #include "defs.hpp"
+#include "metrics.hpp"
+#include "json.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -21,7 +48,10 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
@@ -31,6 +61,8 @@
 extern std::string expand_user_path(const std::string&);
 
 #define SOCKET_PATH "/tmp/hll_socket.sock"
+#define PROTOCOL_VERSION 3
+#define SHM_FLAG 0x80000000u // set in the length word of a version 3 frame whose payload is a shared-memory reference
 
 struct unique_fd { // Helper class
     int fd;
@@ -53,24 +85,146 @@ class unix_socket_client { // Helper class
 public:
     explicit unix_socket_client(const std::string& socketPath);
     unix_socket_client(const unix_socket_client&) = delete;
-    ~unix_socket_client() = default;
+    ~unix_socket_client();
 
+    void negotiate(); // picks the protocol version; see the top of the file
     std::string post(const std::string& data);
+    bool send(const std::string& data, uint32_t id); // false if the connection turned out to be dead; nothing was delivered in that case
+    std::string receive(uint32_t id); // blocks until the response to request `id` arrives, buffering responses to other requests
 
     bool ping() noexcept;
+    bool alive() noexcept; // false once the server has closed its end (e.g. it was restarted)
+    size_t outstanding() const { return inflight; }
+
+    int protocol = 1;
+    bool legacy = false; // server rejected "hello"; one request per connection
 
 private:
     unique_fd sock;
     std::string socketPath;
     pid_t helper_pid = -1;
+    unique_fd ready; // read end of the readiness pipe of a server we started
+
+    size_t inflight = 0;
+    std::deque<uint32_t> v1_order; // version 1 answers in order, so the ids of outstanding requests are matched up FIFO
+    std::map<uint32_t, std::string> arrived; // responses read while waiting for a different request
+    std::map<uint32_t, std::string> shm_sent; // request id -> shared-memory object holding that request's payload
 
     bool recv_all(void* buf, size_t len);
+    std::string recv_frame(uint32_t& id);
     pid_t start_server();
 };
 
+std::unique_ptr<unix_socket_client> shared_client;
+ipc_histogram ipc_latency;
+uint32_t next_request_id = 1;
+bool legacy_server = false; // remembered so the rejected negotiation isn't repeated on every connection
+std::map<uint32_t, std::string> legacy_replies;
+
+uint32_t post_async(const std::string& data) {
+    uint32_t id = next_request_id++;
+
+    if (legacy_server) {
+        unix_socket_client client(SOCKET_PATH);
+        legacy_replies[id] = client.post(data);
+        return id;
+    }
+
+    for (int attempt = 0;; attempt++) {
+        // a connection with requests in flight is readable by design, so it is only checked while idle
+        if (shared_client && shared_client->outstanding() == 0 && !shared_client->alive()) {
+            shared_client.reset();
+            metricadd("ipc.reconnects");
+        }
+        if (!shared_client) {
+            auto client = std::make_unique<unix_socket_client>(SOCKET_PATH);
+            client->negotiate();
+            if (client->legacy) {
+                legacy_server = true;
+                return post_async(data);
+            }
+            shared_client = std::move(client);
+        }
+        if (shared_client->send(data, id)) return id;
+
+        // the server went away between the liveness check and the send; a fresh connection (re)starts it,
+        // unless earlier requests are still waiting on this one
+        bool idle = shared_client->outstanding() == 0;
+        shared_client.reset();
+        metricadd("ipc.reconnects");
+        if (!idle || attempt > 0) throw std::runtime_error("Failed to send request to the action server");
+    }
+}
+
+std::string wait_reply(uint32_t id) {
+    auto it = legacy_replies.find(id);
+    if (it != legacy_replies.end()) {
+        std::string out = std::move(it->second);
+        legacy_replies.erase(it);
+        return out;
+    }
+    if (!shared_client) throw std::runtime_error("Connection to the action server was lost");
+    try { return shared_client->receive(id); }
+    catch (...) { shared_client.reset(); throw; } // the request may or may not have been handled, so it is not resent
+}
+
+long busy_retry_ms(const std::string& reply) { // -1 unless the server turned the request away; see the top of the file
+    if (reply.size() > 256 || reply.find("busy") == std::string::npos) return -1; // a busy reply is small; don't parse every large one twice
+    try {
+        auto r = json::loadFromString(reply);
+        auto& d = r->getDict();
+        auto status = d.find("status");
+        if (status == d.end() || status->second->getDtype() != json::dtype::lstring || status->second->getString() != "busy") return -1;
+        auto wait = d.find("retry_after_ms");
+        return wait != d.end() && wait->second->getDtype() == json::dtype::lint ? wait->second->getInt() : 20;
+    }
+    catch (...) { return -1; } // not a JSON object, so not a busy reply
+}
+
 std::string post(const std::string& data) {
-    unix_socket_client client(SOCKET_PATH);
-    return client.post(data);
+    auto start = std::chrono::steady_clock::now();
+
+    std::string out = wait_reply(post_async(data));
+    for (long wait; (wait = busy_retry_ms(out)) >= 0;) {
+        metricadd("ipc.busy");
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min(wait, 1000L)));
+        out = wait_reply(post_async(data));
+    }
+
+    ipc_latency.record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    metricadd("ipc.requests");
+    metricset("ipc.latency_p50_us", ipc_latency.percentile(50));
+    metricset("ipc.latency_p99_us", ipc_latency.percentile(99));
+    return out;
+}
+
+void disconnect() { shared_client.reset(); }
+
+const ipc_histogram& ipc_latencies() { return ipc_latency; }
+
+void ipc_histogram::record(double us) {
+    int b = 0;
+    while (b < BUCKETS - 1 && (double)(1ULL << b) < us) b++;
+    counts[b]++;
+    total++;
+}
+
+double ipc_histogram::percentile(double p) const {
+    if (total == 0) return 0;
+    uint64_t target = (uint64_t)(p / 100 * (double)total);
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += counts[b];
+        if (seen > target) return (double)(1ULL << b);
+    }
+    return (double)(1ULL << (BUCKETS - 1));
+}
+
+void ipc_histogram::print(std::ostream& out) const {
+    for (int b = 0; b < BUCKETS; b++) {
+        if (counts[b] == 0) continue;
+        out << "<= " << (1ULL << b) << " us: " << counts[b] << "\n";
+    }
 }
 
 namespace {
@@ -102,7 +256,7 @@ bool write_full(int fd, const void* buf, size_t len) {
     auto* p   = static_cast<const unsigned char*>(buf);
     size_t wr = 0;
     while (wr < len) {
-        ssize_t r = ::write(fd, p + wr, len - wr);
+        ssize_t r = ::send(fd, p + wr, len - wr, MSG_NOSIGNAL); // a server that went away must not kill us with SIGPIPE
         if (r < 0) {
             if (errno == EINTR) continue;
             return false;
@@ -114,6 +268,67 @@ bool write_full(int fd, const void* buf, size_t len) {
 
 // ----------------------------------------------------------------------------
 
+// ---------------------------- shared-memory payloads ----------------------------
+
+size_t shm_threshold() {
+    static size_t t = (size_t)std::max(0L, envint("HLL_IPC_SHM_BYTES", 1 << 20)); // 0 disables the side channel
+    return t;
+}
+
+std::string shm_store(const std::string& data) { // returns the name of a new object holding `data`
+    static uint64_t counter = 0;
+    std::string name = "/hll_ipc_" + std::to_string(::getpid()) + "_" + std::to_string(counter++);
+
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "shm_open");
+    bool ok = ::ftruncate(fd, (off_t)data.size()) == 0;
+    if (ok && !data.empty()) {
+        void* p = ::mmap(nullptr, data.size(), PROT_WRITE, MAP_SHARED, fd, 0);
+        ok = p != MAP_FAILED;
+        if (ok) {
+            std::memcpy(p, data.data(), data.size());
+            ::munmap(p, data.size());
+        }
+    }
+    int err = errno;
+    ::close(fd);
+    if (!ok) {
+        ::shm_unlink(name.c_str());
+        throw std::system_error(err, std::generic_category(), "Failed to write shared-memory payload");
+    }
+
+    metricadd("ipc.shm_sent");
+    metricadd("ipc.shm_bytes", data.size());
+    return name;
+}
+
+std::string shm_load(const std::string& ref) { // payload behind a reference frame; the object is unlinked
+    auto r = json::loadFromString(ref);
+    auto name = r->getDict()["shm"]->getString();
+    auto size = (size_t)r->getDict()["size"]->getInt();
+
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "Failed to open shared-memory payload " + name);
+    ::shm_unlink(name.c_str());
+
+    std::string out(size, '\0');
+    bool ok = true;
+    if (size > 0) {
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ok = p != MAP_FAILED;
+        if (ok) {
+            std::memcpy(out.data(), p, size);
+            ::munmap(p, size);
+        }
+    }
+    ::close(fd);
+    if (!ok) throw std::runtime_error("Failed to map shared-memory payload " + name);
+
+    metricadd("ipc.shm_received");
+    metricadd("ipc.shm_bytes", size);
+    return out;
+}
+
 void copy_socket_path(sockaddr_un& addr, const std::string& path) {
     if (path.size() >= sizeof(addr.sun_path))
         throw std::system_error(ENAMETOOLONG, std::generic_category(),
@@ -158,11 +373,31 @@ int try_connect_once(const std::string& path, int& out_errno) {
     return -1;
 }
 
+double last_start_ms = -1; // how long the server we started took until it was listening
+
+// Waits for the readiness signal ("ready <ms since the script started>\n") of a server we started; see server.py.
+// Returns true once it arrived, false if the wait timed out; throws if the server exited without sending it.
+bool wait_ready(int fd, std::chrono::milliseconds wait) {
+    pollfd p{ fd, POLLIN, 0 };
+    int r = ::poll(&p, 1, (int)wait.count());
+    if (r <= 0) return false;
+
+    char buf[64];
+    ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+    if (n <= 0) throw std::runtime_error("action server exited during startup; see " hll_projects_folder "hll_server.log");
+    buf[n] = '\0';
+    if (std::strncmp(buf, "ready", 5) != 0) return false;
+    metricset("ipc.server_init_ms", std::atof(buf + 5));
+    return true;
+}
+
 // Retry connect with exponential backoff up to overall timeout. Throws on timeout or hard error.
 // Only treats ENOENT/ECONNREFUSED as "keep waiting"; anything else throws immediately.
+// With a readiness pipe, the waits between attempts end as soon as the server reports that it is listening.
 int connect_with_retry(const std::string& path, pid_t helper_pid,
                        std::chrono::milliseconds overall =
-                           std::chrono::milliseconds(3000)) {
+                           std::chrono::milliseconds(3000),
+                       int ready_fd = -1) {
     auto deadline = std::chrono::steady_clock::now() + overall;
     int  delay_ms = 25;
     int  last_err = 0;
@@ -188,7 +423,13 @@ int connect_with_retry(const std::string& path, pid_t helper_pid,
             throw std::runtime_error("timeout waiting for helper socket");
         }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        if (ready_fd >= 0) {
+            if (wait_ready(ready_fd, std::chrono::milliseconds(delay_ms))) {
+                ready_fd = -1; // signalled; the next attempt connects
+                continue;
+            }
+        }
+        else std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
         delay_ms = std::min(delay_ms * 2, 250);
     }
 }
@@ -307,8 +548,17 @@ unix_socket_client::unix_socket_client(const std::string& socketPath)
         ? std::chrono::milliseconds(std::stoi(env_timeout ? env_timeout : "120000"))
         : std::chrono::milliseconds(2000);
 
+    auto start = std::chrono::steady_clock::now();
+    sock.reset(connect_with_retry(socketPath, helper_pid, wait_ms, ready.get()));
+    ready.reset();
+    if (spawned) {
+        last_start_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        metricset("ipc.server_start_ms", last_start_ms);
+    }
+}
 
-    sock.reset(connect_with_retry(socketPath, helper_pid, wait_ms));
+unix_socket_client::~unix_socket_client() {
+    for (const auto& sent : shm_sent) ::shm_unlink(sent.second.c_str()); // requests whose responses never came
 }
 
 bool unix_socket_client::recv_all(void* buf, size_t len) {
@@ -316,26 +566,104 @@ bool unix_socket_client::recv_all(void* buf, size_t len) {
     return r == static_cast<ssize_t>(len);
 }
 
+void unix_socket_client::negotiate() {
+    const char* forced = ::getenv("HLL_IPC_PROTOCOL");
+    if (forced && std::atoi(forced) == 1) return;
+
+    int wanted = PROTOCOL_VERSION;
+    if (forced) wanted = std::max(1, std::min(wanted, std::atoi(forced)));
+
+    // sent as a version 1 frame; the reply decides the framing of everything after it
+    std::string reply = post(R"({"data":{"protocol":)" + std::to_string(wanted) + R"(},"request":"hello"})");
+    try {
+        auto r = json::loadFromString(reply);
+        auto& rd = r->getDict();
+        if (rd["status"]->getString() != "ok") legacy = true;
+        else protocol = (int)std::min<int64_t>(wanted, rd["data"]->getDict()["protocol"]->getInt());
+    }
+    catch (...) { } // anything unexpected: stay on version 1
+}
+
 std::string unix_socket_client::post(const std::string& data) {
-    // Length-prefixed message
-    uint32_t len = htonl(static_cast<uint32_t>(data.size()));
-    if (!write_full(sock.get(), &len, sizeof(len))) {
-        throw std::runtime_error("Failed to send data length");
+    uint32_t id = 0;
+    if (!send(data, id)) {
+        throw std::runtime_error("Failed to send data");
+    }
+    return receive(id);
+}
+
+bool unix_socket_client::send(const std::string& data, uint32_t id) {
+    bool ok;
+    if (protocol >= 3 && shm_threshold() > 0 && data.size() >= shm_threshold()) { // [length of id + reference | SHM_FLAG][id][reference]
+        auto name = shm_store(data);
+        std::string ref = R"({"shm":")" + name + R"(","size":)" + std::to_string(data.size()) + "}";
+        uint32_t header[2] = { htonl(static_cast<uint32_t>(ref.size() + sizeof(uint32_t)) | SHM_FLAG), htonl(id) };
+        ok = write_full(sock.get(), header, sizeof(header)) && write_full(sock.get(), ref.data(), ref.size());
+        if (ok) shm_sent[id] = name;
+        else ::shm_unlink(name.c_str());
+    }
+    else if (protocol >= 2) { // [length of id + payload][id][payload]
+        uint32_t header[2] = { htonl(static_cast<uint32_t>(data.size() + sizeof(uint32_t))), htonl(id) };
+        ok = write_full(sock.get(), header, sizeof(header)) && write_full(sock.get(), data.data(), data.size());
     }
-    if (!write_full(sock.get(), data.data(), data.size())) {
-        throw std::runtime_error("Failed to send data payload");
+    else { // [length of payload][payload]
+        uint32_t len = htonl(static_cast<uint32_t>(data.size()));
+        ok = write_full(sock.get(), &len, sizeof(len)) && write_full(sock.get(), data.data(), data.size());
+        if (ok) v1_order.push_back(id);
     }
+    if (ok) inflight++;
+    return ok;
+}
 
+std::string unix_socket_client::recv_frame(uint32_t& id) {
     uint32_t resp_len_n = 0;
     if (!recv_all(&resp_len_n, sizeof(resp_len_n))) {
         throw std::runtime_error("Failed to read response length");
     }
     uint32_t resp_len = ntohl(resp_len_n);
+    bool shm = protocol >= 3 && (resp_len & SHM_FLAG);
+    resp_len &= ~SHM_FLAG;
+
+    if (protocol >= 2) {
+        uint32_t id_n = 0;
+        if (resp_len < sizeof(id_n) || !recv_all(&id_n, sizeof(id_n))) {
+            throw std::runtime_error("Failed to read response id");
+        }
+        id = ntohl(id_n);
+        resp_len -= sizeof(id_n);
+    }
+    else {
+        if (v1_order.empty()) throw std::runtime_error("Unexpected response from action server");
+        id = v1_order.front();
+        v1_order.pop_front();
+    }
 
     std::string out(resp_len, '\0');
     if (!recv_all(out.data(), resp_len)) {
         throw std::runtime_error("Failed to read response payload");
     }
+
+    auto sent = shm_sent.find(id);
+    if (sent != shm_sent.end()) {
+        ::shm_unlink(sent->second.c_str()); // normally gone already
+        shm_sent.erase(sent);
+    }
+    return shm ? shm_load(out) : out;
+}
+
+std::string unix_socket_client::receive(uint32_t id) {
+    auto it = arrived.find(id);
+    if (it == arrived.end()) {
+        while (true) {
+            uint32_t got;
+            std::string out = recv_frame(got);
+            inflight--;
+            if (got == id) return out;
+            arrived[got] = std::move(out);
+        }
+    }
+    std::string out = std::move(it->second);
+    arrived.erase(it);
     return out;
 }
 
@@ -352,17 +680,37 @@ bool unix_socket_client::ping() noexcept {
     }
 }
 
+bool unix_socket_client::alive() noexcept {
+    // an idle connection has nothing to read; readable means EOF (or stray data), either way it can't be reused
+    pollfd p{ sock.get(), POLLIN, 0 };
+    int r = ::poll(&p, 1, 0);
+    return r == 0;
+}
+
 pid_t unix_socket_client::start_server() {
 
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) == -1) {
+        throw std::system_error(errno, std::generic_category(), "pipe");
+    }
+
     pid_t pid = ::fork();
     if (pid == -1) {
+        ::close(fds[0]);
+        ::close(fds[1]);
         throw std::runtime_error("fork() failed");
     }
     if (pid == 0) {
         // --- Child process ---
         ::setsid();  // New session, detach from terminal
 
-        // Open a logfile for stdout/stderr
+        // The write end of the readiness pipe is handed to the server; see server.py, signal_ready()
+        ::close(fds[0]);
+        int flags = ::fcntl(fds[1], F_GETFD);
+        if (flags != -1) ::fcntl(fds[1], F_SETFD, flags & ~FD_CLOEXEC);
+        ::setenv("HLL_READY_FD", std::to_string(fds[1]).c_str(), 1);
+
+        // Open a logfile for stdout/stderr (lifecycle messages and tracebacks; requests go to hll_requests.log, see server.py)
         std::string log_path = expand_user_path(hll_projects_folder "/hll_server.log");
         int logfd = ::open(log_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
         if (logfd >= 0) {
@@ -386,10 +734,22 @@ pid_t unix_socket_client::start_server() {
         dprintf(STDERR_FILENO, "execlp failed to start server (%d): %s\n", e, std::strerror(e));
         _exit(127);
     }
-    // --- Parent just returns ---
+    // --- Parent keeps the read end ---
+    ::close(fds[1]);
+    ready.reset(fds[0]);
     return pid;
 }
 
+double ensure_server() {
+    last_start_ms = -1;
+    if (!shared_client) {
+        auto client = std::make_unique<unix_socket_client>(SOCKET_PATH);
+        client->negotiate();
+        if (!client->legacy) shared_client = std::move(client);
+    }
+    return last_start_ms;
+}
+
 void kill_server()
 {
     const char* pidfile = "/tmp/hll_server.pid";
@@ -418,9 +778,12 @@ void kill_server()
 
         std::cout << "Sending SIGKILL to server (" << pid << ")…\n";
         ::kill(pid, SIGKILL);
+        for (int i = 0; i < 100 && ::kill(pid, 0) == 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
+        std::string mode;
+        in >> mode;                            // "activated": the socket belongs to systemd, which keeps listening on it
         std::remove(pidfile);
-        std::remove(SOCKET_PATH);              // tidy up the stale socket
+        if (mode != "activated") std::remove(SOCKET_PATH); // tidy up the stale socket
         std::cout << "Server stopped.\n";
     });
 }